@@ -29,12 +29,15 @@ int main()
     struct svm_parameter params = {.svm_type=C_SVC, .kernel_type=POLY, .degree=2, .gamma=1.0/DIM, .C=10000,
       .cache_size=1000, .eps=1e-3};
     PSP_Configure_SVM(hn, &params);
+    PSP_Partition partition = NULL;
 #if KD
     PSP_KdSVMTree tree = NULL;
     PSP_Build_Partition_KdSVM(hn, &tree);
+    PSP_Compile_KdSVM(tree, &partition);
 #else
     PSP_MCSVM svm = NULL;
     PSP_Build_Partition_MCSVM(hn, &svm);
+    PSP_Compile_MCSVM(svm, &partition);
 #endif
 
     psp_dump_points(hn);
@@ -51,20 +54,7 @@ int main()
             xd1[i] = a / 65536.0;
         }
         struct svm_node node = { DIM, xd1 };
-#if KD
-        PSP_KdSVMTree curr = tree;
-        while (curr->node.left && curr->node.right) {
-            if (svm_predict(curr->data.model, &node) > 0) {
-                curr = (PSP_KdSVMTree)curr->node.left;
-            } else {
-                curr = (PSP_KdSVMTree)curr->node.right;
-            }
-        }
-        size_t predicted = curr->data.pattern;
-#else
-        PSP_MCSVM curr = svm;
-        size_t predicted = svm_predict(curr->model, &node);
-#endif
+        size_t predicted = PSP_Predict(partition, &node);
         size_t actual = sampl(NULL, x1);
         fprintf(stdout, "%ld -> %ld\n", actual, predicted);
     }
@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pspart.h>
+
+
+#define DIM 3
+#define NUM_POINTS 200000
+
+typedef size_t (*Predict_Func)(const double* x);
+
+size_t sampl(void* sc, long* pnt)
+{
+    long sum = 0;
+    size_t dec = 0;
+    for (int i = 0; i < DIM; i++) {
+        sum += labs(pnt[i]);
+        dec |= (pnt[i] < 0 ? 0L : 1L)  << i;
+    }
+    return 100 + (sum < 65536 ? 16 : dec);
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Exports the partition to `name`.c, compiles it with $CC into `name`.so and
+ * loads its predictor.
+ */
+static Predict_Func export_partition(PSP_Partition partition, const char* name, void** so)
+{
+    char source[256], library[256], command[1024];
+    snprintf(source, sizeof(source), "%s.c", name);
+    snprintf(library, sizeof(library), "./%s.so", name);
+
+    int rc = PSP_Export_C(partition, source);
+    if (rc) {
+        fprintf(stderr, "%s: export failed with %d\n", name, rc);
+        return NULL;
+    }
+
+    const char* cc = getenv("CC") ? getenv("CC") : "cc";
+    snprintf(command, sizeof(command), "%s -std=c89 -pedantic -Wall -O2 -shared -fPIC %s -o %s -lm",
+             cc, source, library);
+    if (system(command)) {
+        fprintf(stderr, "%s: %s failed\n", name, command);
+        return NULL;
+    }
+
+    *so = dlopen(library, RTLD_NOW);
+    if (!*so) {
+        fprintf(stderr, "%s: %s\n", name, dlerror());
+        return NULL;
+    }
+    // the conversion POSIX recommends, as ISO C has none to function pointers
+    Predict_Func predict;
+    *(void**)&predict = dlsym(*so, "psp_partition_predict");
+    return predict;
+}
+
+/**
+ * Compares the predictions of the exported partition with those of the
+ * library on random points and reports the time of each.
+ */
+static int check_partition(const char* name,
+                           PSP_Partition partition,
+                           PSP_KdSVMTree tree,
+                           PSP_MCSVM svm,
+                           const double* points)
+{
+    void* so = NULL;
+    Predict_Func predict = export_partition(partition, name, &so);
+    if (!predict) {
+        if (so)
+            dlclose(so);
+        return 1;
+    }
+
+    size_t* expected = malloc(NUM_POINTS * sizeof(size_t));
+    size_t* actual = malloc(NUM_POINTS * sizeof(size_t));
+    int mismatches = 0;
+
+    double t = now();
+    for (int k = 0; k < NUM_POINTS; k++) {
+        struct svm_node node = { DIM, (double*)points + k * DIM };
+        expected[k] = PSP_Predict(partition, &node);
+    }
+    double t_library = now() - t;
+
+    // the models the partition was compiled from
+    for (int k = 0; k < NUM_POINTS; k++) {
+        struct svm_node node = { DIM, (double*)points + k * DIM };
+        size_t pattern = tree ? PSP_Predict_KdSVM(tree, &node)
+                              : (size_t)svm_predict(svm->model, &node);
+        mismatches += pattern != expected[k];
+    }
+
+    t = now();
+    for (int k = 0; k < NUM_POINTS; k++) {
+        actual[k] = predict(points + k * DIM);
+    }
+    double t_exported = now() - t;
+
+    for (int k = 0; k < NUM_POINTS; k++) {
+        mismatches += actual[k] != expected[k];
+    }
+
+    fprintf(stdout, "%s: %d mismatches, PSP_Predict %.3fs, exported %.3fs for %d points\n",
+            name, mismatches, t_library, t_exported, NUM_POINTS);
+
+    free(expected);
+    free(actual);
+    dlclose(so);
+    return mismatches != 0;
+}
+
+int main()
+{
+    PSP_Handle hn = PSP_New(DIM);
+    PSP_Sampling_CallbackRec cb = {hn, sampl};
+    Fixed x0[DIM] = { 0,0,0 };
+    Fixed xm[DIM] = { -65536,-65536,-65536 };
+    Fixed xM[DIM] = { 65536,65536,65536 };
+    PSP_Options options = {0};
+    options.maxPatterns = 100;
+    options.maxPsp = 1;
+    PSP_Get_Regions(hn, &cb, 1, x0, xm, xM, options, PSP_RESULT_APPEND);
+    // a low penalty keeps the training short, the check being on prediction
+    struct svm_parameter params = {.svm_type=C_SVC, .kernel_type=RBF, .gamma=2, .C=10,
+      .cache_size=100, .eps=1e-3};
+    PSP_Configure_SVM(hn, &params);
+
+    PSP_KdSVMTree tree = NULL;
+    PSP_MCSVM svm = NULL;
+    PSP_Partition kdsvm = NULL, mcsvm = NULL;
+    if (PSP_Build_Partition_KdSVM(hn, &tree) || PSP_Compile_KdSVM(tree, &kdsvm) ||
+        PSP_Build_Partition_MCSVM(hn, &svm) || PSP_Compile_MCSVM(svm, &mcsvm)) {
+        fprintf(stderr, "building the partitions failed\n");
+        return 1;
+    }
+
+    double* points = malloc(NUM_POINTS * DIM * sizeof(double));
+    srand(1);
+    for (int k = 0; k < NUM_POINTS * DIM; k++) {
+        points[k] = ((rand() % 131072) - 65536) / 65536.0;
+    }
+
+    int failed = check_partition("export_kdsvm", kdsvm, tree, NULL, points)
+               | check_partition("export_mcsvm", mcsvm, NULL, svm, points);
+
+    free(points);
+    PSP_Free_Partition(kdsvm);
+    PSP_Free_Partition(mcsvm);
+    PSP_Free_Models(hn);
+    PSP_Close(hn);
+    return failed;
+}
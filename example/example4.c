@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pspart.h>
+
+
+#define DIM 2
+#define NUM_JOBS 64
+#define NUM_HANDLES 32
+#define NUM_POINTS 2000
+
+size_t sampl(void* sc, const double* pnt)
+{
+    double sum = 0;
+    size_t dec = 0;
+    for (int i = 0; i < DIM; i++) {
+        sum += pnt[i] < 0 ? -pnt[i] : pnt[i];
+        dec |= (size_t)(pnt[i] >= 0) << i;
+    }
+    return 100 + (sum < 1 ? 16 : dec);
+}
+
+struct job {
+    int id;
+    int errors;
+    int reload_mismatches;
+};
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Searches the regions, builds an MCSVM partition and checks that its model
+ * predicts the same after being saved and loaded again.
+ */
+static int run_job(PSP_Handle hn, void* job_context)
+{
+    struct job* job = job_context;
+    PSP_Sampling_Callback_DoubleRec cb = { NULL, sampl, NULL };
+    double x0[DIM] = { 0.1,0.1 };
+    double xm[DIM] = { -1,-1 };
+    double xM[DIM] = { 1,1 };
+    PSP_Options options = {0};
+    options.maxPatterns = 100;
+    options.maxPsp = 1;
+    int rc = PSP_Get_Regions_Double(hn, &cb, 1, x0, xm, xM, options, PSP_RESULT_OVERWRITE);
+    if (rc)
+        return rc;
+
+    struct svm_parameter params = {.svm_type=C_SVC, .kernel_type=RBF, .degree=2, .gamma=2, .C=1000,
+      .cache_size=20, .eps=1e-3, .linear_tol=-1};
+    PSP_Configure_SVM(hn, &params);
+    PSP_MCSVM svm = NULL;
+    rc = PSP_Build_Partition_MCSVM(hn, &svm);
+    if (rc)
+        return rc;
+
+    char path[64];
+    snprintf(path, sizeof(path), "example4_job%d.model", job->id);
+    if (svm_save_model(path, svm->model))
+        return -1;
+    struct svm_model* loaded = svm_load_model(path);
+    remove(path);
+    if (!loaded)
+        return -1;
+
+    unsigned int seed = job->id;
+    for (int k = 0; k < NUM_POINTS; k++) {
+        double xd[DIM];
+        for (int i = 0; i < DIM; i++) {
+            xd[i] = rand_r(&seed) / (double)RAND_MAX * 2 - 1;
+        }
+        struct svm_node node = { DIM, xd };
+        size_t predicted = (size_t)svm_predict(svm->model, &node);
+        job->errors += predicted != sampl(NULL, xd);
+        job->reload_mismatches += predicted != (size_t)svm_predict(loaded, &node);
+    }
+
+    svm_free_and_destroy_model(&loaded);
+    return 0;
+}
+
+/**
+ * Runs the jobs on a pool of `num_threads` threads, two per handle, and
+ * returns the number of failed jobs and reloaded models predicting otherwise.
+ */
+static int run_pool(size_t num_threads)
+{
+    PSP_Job_Pool pool = PSP_New_Job_Pool(num_threads);
+    if (!pool) {
+        fprintf(stderr, "cannot start a pool of %zu threads\n", num_threads);
+        return 1;
+    }
+
+    PSP_Handle handles[NUM_HANDLES];
+    for (int i = 0; i < NUM_HANDLES; i++) {
+        handles[i] = PSP_New(DIM);
+    }
+
+    struct job jobs[NUM_JOBS];
+    PSP_Job submitted[NUM_JOBS];
+    double t = now();
+    for (int i = 0; i < NUM_JOBS; i++) {
+        jobs[i] = (struct job){ i, 0, 0 };
+        if (PSP_Submit_Job(pool, handles[i % NUM_HANDLES], run_job, &jobs[i], &submitted[i])) {
+            fprintf(stderr, "cannot submit job %d\n", i);
+            return 1;
+        }
+    }
+
+    int failed = 0, max_errors = 0, mismatches = 0;
+    for (int i = 0; i < NUM_JOBS; i++) {
+        int result = 0;
+        if (PSP_Wait_Job(pool, submitted[i], &result) || result) {
+            fprintf(stderr, "job %d failed with %d\n", i, result);
+            failed++;
+        }
+        if (jobs[i].errors > max_errors) {
+            max_errors = jobs[i].errors;
+        }
+        mismatches += jobs[i].reload_mismatches;
+    }
+
+    fprintf(stdout, "%zu threads: %d jobs in %.2fs, %d failed, %d reload mismatches, at most %d/%d errors\n",
+            num_threads, NUM_JOBS, now() - t, failed, mismatches, max_errors, NUM_POINTS);
+
+    PSP_Close_Job_Pool(pool);
+    for (int i = 0; i < NUM_HANDLES; i++) {
+        PSP_Close(handles[i]);
+    }
+    return failed + mismatches;
+}
+
+int main(int argc, char** argv)
+{
+    size_t num_threads = argc > 1 ? (size_t)atoi(argv[1]) : 4;
+
+    int failed = run_pool(1);
+    failed += run_pool(num_threads);
+    return failed != 0;
+}
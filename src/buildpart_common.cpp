@@ -1,6 +1,26 @@
+#include <cmath>
 #include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <vector>
 #include "buildpart_common.h"
 
+// box constraint of the linear separator when the SVM type has no C
+static const double LINEAR_C = 1000;
+// maximum number of passes over the data in the linear solver
+static const int LINEAR_MAX_EPOCHS = 1000;
+// maximum number of training points a reduced decision function is fit on
+static const int REDUCE_MAX_POINTS = 2000;
+// a decision function keeps its SVs unless at most this fraction of them
+// approximates it
+static const double REDUCE_MAX_FRACTION = 0.5;
+// number of times the tolerance of the decision functions is halved when the
+// reduced model disagrees too much with the original one
+static const int REDUCE_MAX_ATTEMPTS = 3;
+
 static inline
 bool check_model(svm_model* model,
                  double coef_max)
@@ -29,7 +49,9 @@ bool check_model(svm_model* model,
 }
 
 struct svm_model* train_svm(const struct svm_problem* problem,
-                            struct svm_parameter& param)
+                            struct svm_parameter& param,
+                            const struct svm_model* init,
+                            const int* init_index)
 {
     svm_model* model = NULL;
     int num_retries = 0;
@@ -60,9 +82,605 @@ struct svm_model* train_svm(const struct svm_problem* problem,
             }
         }
 
-        model = svm_train(problem, &param);
+        model = svm_train_warm(problem, &param, init, init_index);
 
     } while (!check_model(model, param.coef_max));
 
+    if (model) {
+        DEBUG_LOG("train_svm: " << problem->l << " points, " << model->stats.iter
+                  << " iterations, " << model->stats.time << " s, eps " << model->stats.eps
+                  << ", status " << model->stats.status << '\n');
+    }
+
     return model;
 }
+
+/**
+ * Trains a linear SVM with a bias term by dual coordinate descent (Hsieh et
+ * al., ICML 2008), which is much cheaper than running the kernel solver with a
+ * linear kernel. The result is returned as a two-class LINEAR model with the
+ * normal vector as its only SV, so that it can be used with `svm_predict`.
+ */
+struct svm_model* train_linear_svm(const struct svm_problem* problem,
+                                   struct svm_parameter const& param,
+                                   double* error_rate)
+{
+    int l = problem->l;
+    int dim = l > 0 ? problem->x[0].dim : 0;
+    double C = param.svm_type == C_SVC ? param.C : LINEAR_C;
+    double eps = param.eps > 0 ? param.eps : 1e-3;
+
+    // the bias is learned as the weight of a constant feature
+    std::vector<double> w(dim + 1, 0.0);
+    std::vector<double> alpha(l, 0.0);
+    std::vector<double> QD(l);
+    std::vector<int> index(l);
+    std::iota(index.begin(), index.end(), 0);
+    std::default_random_engine generator(0);
+    auto start_time = std::chrono::steady_clock::now();
+    int epoch = 0;
+    double gap = HUGE_VAL;
+
+    for (int i = 0; i < l; i++) {
+        const double* x = problem->x[i].values;
+        QD[i] = std::inner_product(x, x + dim, x, 1.0);
+    }
+
+    for (; epoch < LINEAR_MAX_EPOCHS; epoch++) {
+        double PG_max = -HUGE_VAL;
+        double PG_min = HUGE_VAL;
+
+        std::shuffle(index.begin(), index.end(), generator);
+        for (int i : index) {
+            const double* x = problem->x[i].values;
+            double y = problem->y[i] > 0 ? 1 : -1;
+            double G = y * std::inner_product(x, x + dim, w.data(), w[dim]) - 1;
+
+            double PG = G;
+            if (alpha[i] <= 0)
+                PG = std::min(G, 0.0);
+            else if (alpha[i] >= C)
+                PG = std::max(G, 0.0);
+
+            PG_max = std::max(PG_max, PG);
+            PG_min = std::min(PG_min, PG);
+
+            if (PG != 0) {
+                double alpha_old = alpha[i];
+                alpha[i] = std::min(std::max(alpha[i] - G / QD[i], 0.0), C);
+                double d = (alpha[i] - alpha_old) * y;
+                for (int j = 0; j < dim; j++)
+                    w[j] += d * x[j];
+                w[dim] += d;
+            }
+        }
+
+        gap = PG_max - PG_min;
+        if (gap <= eps)
+            break;
+    }
+
+    int errors = 0;
+    for (int i = 0; i < l; i++) {
+        const double* x = problem->x[i].values;
+        double dec = std::inner_product(x, x + dim, w.data(), w[dim]);
+        if ((dec > 0) != (problem->y[i] > 0))
+            errors++;
+    }
+    if (error_rate)
+        *error_rate = l > 0 ? (double)errors / l : 0;
+
+    svm_model* model = (svm_model*)malloc(sizeof(svm_model));
+    model->param = param;
+    model->param.kernel_type = LINEAR;
+    model->param.nr_weight = 0;
+    model->param.weight_label = NULL;
+    model->param.weight = NULL;
+    model->nr_class = 2;
+    model->l = 1;
+    model->SV = (svm_node*)malloc(sizeof(svm_node));
+    model->SV[0].dim = dim;
+    model->SV[0].values = (double*)malloc(dim * sizeof(double));
+    std::copy(w.begin(), w.begin() + dim, model->SV[0].values);
+    model->sv_coef = (double**)malloc(sizeof(double*));
+    model->sv_coef[0] = (double*)malloc(sizeof(double));
+    model->sv_coef[0][0] = 1;
+    model->rho = (double*)malloc(sizeof(double));
+    model->rho[0] = -w[dim];
+    model->probA = NULL;
+    model->probB = NULL;
+    model->sv_indices = NULL;
+    model->label = (int*)malloc(2 * sizeof(int));
+    model->label[0] = +1;
+    model->label[1] = -1;
+    model->nSV = (int*)malloc(2 * sizeof(int));
+    model->nSV[0] = 1;
+    model->nSV[1] = 0;
+    model->free_sv = 1;
+    model->nr_scale = 0;
+    model->x_shift = NULL;
+    model->x_scale = NULL;
+    model->stats.iter = epoch;
+    model->stats.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    model->stats.eps = gap;
+    model->stats.status = epoch < LINEAR_MAX_EPOCHS ? SOLVER_CONVERGED : SOLVER_MAX_ITER;
+    model->reduction = {};
+
+    return model;
+}
+
+/**
+ * Selects columns of `K` by orthogonal matching pursuit until a constant plus
+ * a linear combination of them has the same sign as `f` at all but
+ * `max_errors` rows, using at most `max_size` columns. The combination is
+ * the least squares fit of `f`, kept as a QR factorization of the selected
+ * columns which grows by one Gram-Schmidt step per column.
+ *
+ * Returns whether it succeeded, with the selected columns, their weights and
+ * the constant.
+ */
+static bool fit_reduced_set(Eigen::MatrixXd const& K,
+                            Eigen::VectorXd const& f,
+                            int max_errors,
+                            int max_size,
+                            std::vector<int>& selected,
+                            Eigen::VectorXd& weights,
+                            double& constant)
+{
+    Eigen::Index n = K.rows();
+    Eigen::MatrixXd Q(n, max_size + 1);
+    Eigen::MatrixXd R = Eigen::MatrixXd::Zero(max_size + 1, max_size + 1);
+    Eigen::VectorXd norms = K.colwise().norm();
+    std::vector<bool> tried(K.cols(), false);
+
+    Q.col(0).setConstant(1 / std::sqrt((double)n));
+    R(0, 0) = std::sqrt((double)n);
+    Eigen::VectorXd residual = f - Q.col(0) * Q.col(0).dot(f);
+
+    selected.clear();
+    while (true) {
+        int errors = 0;
+        for (Eigen::Index t = 0; t < n; t++) {
+            errors += (f[t] - residual[t] > 0) != (f[t] > 0);
+        }
+        if (errors <= max_errors)
+            break;
+        if ((int)selected.size() == max_size)
+            return false;
+
+        Eigen::VectorXd corr = K.transpose() * residual;
+        Eigen::Index best = -1;
+        double best_corr = 0;
+        for (Eigen::Index j = 0; j < K.cols(); j++) {
+            if (!tried[j] && norms[j] > 0 && std::abs(corr[j]) / norms[j] > best_corr) {
+                best = j;
+                best_corr = std::abs(corr[j]) / norms[j];
+            }
+        }
+        if (best < 0)
+            return false;
+        tried[best] = true;
+
+        // orthogonalize twice against the selected columns, for stability
+        size_t s = selected.size() + 1;
+        Eigen::VectorXd v = K.col(best);
+        for (int pass = 0; pass < 2; pass++) {
+            Eigen::VectorXd proj = Q.leftCols(s).transpose() * v;
+            v -= Q.leftCols(s) * proj;
+            R.col(s).head(s) += proj;
+        }
+        double norm = v.norm();
+        if (norm <= 1e-10 * norms[best]) {
+            R.col(s).setZero();
+            continue;
+        }
+
+        R(s, s) = norm;
+        Q.col(s) = v / norm;
+        residual -= Q.col(s) * Q.col(s).dot(residual);
+        selected.push_back(best);
+    }
+
+    size_t s = selected.size() + 1;
+    Eigen::VectorXd theta = R.topLeftCorner(s, s).triangularView<Eigen::Upper>()
+                            .solve(Q.leftCols(s).transpose() * f);
+    constant = theta[0];
+    weights = theta.tail(s - 1);
+    return true;
+}
+
+/**
+ * Reduced decision functions of a classification model, fit on training
+ * points of their two classes.
+ */
+struct Reduced_Pair {
+    bool reduced;
+    std::vector<int> sv;            // indices in the model of the selected SVs
+    std::vector<double> coef;
+    double rho;
+};
+
+static inline
+Reduced_Pair reduce_pair(struct svm_model const* model,
+                         struct svm_problem const* problem,
+                         int i, int j, int p,
+                         std::vector<int> const& start,
+                         double tolerance)
+{
+    Reduced_Pair result = {};
+
+    std::vector<int> points;
+    for (int t = 0; t < problem->l; t++) {
+        if (problem->y[t] == model->label[i] || problem->y[t] == model->label[j])
+            points.push_back(t);
+    }
+    // evenly spaced points, to keep the fit deterministic
+    if (points.size() > (size_t)REDUCE_MAX_POINTS) {
+        std::vector<int> sample(REDUCE_MAX_POINTS);
+        for (int k = 0; k < REDUCE_MAX_POINTS; k++) {
+            sample[k] = points[(size_t)k * points.size() / REDUCE_MAX_POINTS];
+        }
+        points.swap(sample);
+    }
+
+    std::vector<int> candidates;
+    std::vector<double> alpha;
+    for (int c : {i, j}) {
+        int other = c == i ? j : i;
+        double const* coef = model->sv_coef[other > c ? other - 1 : other];
+        for (int k = start[c]; k < start[c] + model->nSV[c]; k++) {
+            candidates.push_back(k);
+            alpha.push_back(coef[k]);
+        }
+    }
+
+    int max_size = (int)(REDUCE_MAX_FRACTION * candidates.size());
+    if (points.empty() || max_size == 0)
+        return result;
+
+    Eigen::MatrixXd K(points.size(), candidates.size());
+    for (size_t t = 0; t < points.size(); t++) {
+        for (size_t k = 0; k < candidates.size(); k++) {
+            K(t, k) = svm_kernel(&problem->x[points[t]], &model->SV[candidates[k]], &model->param);
+        }
+    }
+    Eigen::VectorXd f = K * Eigen::Map<Eigen::VectorXd>(alpha.data(), alpha.size());
+    f.array() -= model->rho[p];
+
+    std::vector<int> selected;
+    Eigen::VectorXd weights;
+    double constant;
+    int max_errors = (int)(tolerance * points.size());
+    if (!fit_reduced_set(K, f, max_errors, max_size, selected, weights, constant))
+        return result;
+
+    result.reduced = true;
+    for (size_t k = 0; k < selected.size(); k++) {
+        result.sv.push_back(candidates[selected[k]]);
+        result.coef.push_back(weights[k]);
+    }
+    result.rho = -constant;
+    return result;
+}
+
+/**
+ * Builds a model with the SVs used by the given decision functions, those not
+ * reduced keeping the SVs and coefficients of `model`.
+ */
+static inline
+struct svm_model* reduced_model(struct svm_model const* model,
+                                std::vector<Reduced_Pair> const& pairs,
+                                std::vector<int> const& start)
+{
+    int nr_class = model->nr_class;
+    std::vector<int> index(model->l, -1);
+
+    int p = 0;
+    for (int i = 0; i < nr_class; i++) {
+        for (int j = i + 1; j < nr_class; j++, p++) {
+            if (pairs[p].reduced) {
+                for (int k : pairs[p].sv) {
+                    index[k] = 0;
+                }
+            } else {
+                std::fill(index.begin() + start[i], index.begin() + start[i] + model->nSV[i], 0);
+                std::fill(index.begin() + start[j], index.begin() + start[j] + model->nSV[j], 0);
+            }
+        }
+    }
+
+    svm_model* result = (svm_model*)malloc(sizeof(svm_model));
+    *result = *model;
+    result->param.nr_weight = 0;
+    result->param.weight_label = NULL;
+    result->param.weight = NULL;
+    result->probA = NULL;
+    result->probB = NULL;
+    result->sv_indices = NULL;
+    result->nr_scale = 0;
+    result->x_shift = NULL;
+    result->x_scale = NULL;
+    result->free_sv = 1;
+
+    result->label = (int*)malloc(nr_class * sizeof(int));
+    std::copy(model->label, model->label + nr_class, result->label);
+    result->nSV = (int*)calloc(nr_class, sizeof(int));
+
+    int l = 0;
+    for (int c = 0; c < nr_class; c++) {
+        for (int k = start[c]; k < start[c] + model->nSV[c]; k++) {
+            if (index[k] >= 0) {
+                index[k] = l++;
+                result->nSV[c]++;
+            }
+        }
+    }
+    result->l = l;
+
+    result->SV = (svm_node*)malloc(l * sizeof(svm_node));
+    for (int k = 0; k < model->l; k++) {
+        if (index[k] >= 0) {
+            svm_node& sv = result->SV[index[k]];
+            sv.dim = model->SV[k].dim;
+            sv.values = (double*)malloc(sv.dim * sizeof(double));
+            std::copy(model->SV[k].values, model->SV[k].values + sv.dim, sv.values);
+        }
+    }
+
+    result->sv_coef = (double**)malloc((nr_class - 1) * sizeof(double*));
+    for (int c = 0; c < nr_class - 1; c++) {
+        result->sv_coef[c] = (double*)calloc(l, sizeof(double));
+    }
+    result->rho = (double*)malloc(nr_class * (nr_class - 1) / 2 * sizeof(double));
+
+    // the coefficient of an SV of class i in the decision function against
+    // class j is in sv_coef[j-1] if j > i, sv_coef[j] otherwise
+    p = 0;
+    for (int i = 0; i < nr_class; i++) {
+        for (int j = i + 1; j < nr_class; j++, p++) {
+            if (pairs[p].reduced) {
+                for (size_t k = 0; k < pairs[p].sv.size(); k++) {
+                    int sv = pairs[p].sv[k];
+                    int row = sv < start[j] ? j - 1 : i;
+                    result->sv_coef[row][index[sv]] = pairs[p].coef[k];
+                }
+                result->rho[p] = pairs[p].rho;
+            } else {
+                for (int k = start[i]; k < start[i] + model->nSV[i]; k++) {
+                    result->sv_coef[j - 1][index[k]] = model->sv_coef[j - 1][k];
+                }
+                for (int k = start[j]; k < start[j] + model->nSV[j]; k++) {
+                    result->sv_coef[i][index[k]] = model->sv_coef[i][k];
+                }
+                result->rho[p] = model->rho[p];
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Predicts the training set with both models, returning the fraction of
+ * points predicted the same and the ratio of the prediction times.
+ */
+static inline
+void compare_models(struct svm_model const* model,
+                    struct svm_model const* reduced,
+                    struct svm_problem const* problem,
+                    double* agreement,
+                    double* speedup)
+{
+    svm_predictor* a = svm_predictor_create(model);
+    svm_predictor* b = svm_predictor_create(reduced);
+    std::vector<double> labels(problem->l);
+    int same = 0;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (int t = 0; t < problem->l; t++) {
+        labels[t] = a ? svm_predictor_predict(a, &problem->x[t], NULL) : svm_predict(model, &problem->x[t]);
+    }
+    auto mid_time = std::chrono::steady_clock::now();
+    for (int t = 0; t < problem->l; t++) {
+        double label = b ? svm_predictor_predict(b, &problem->x[t], NULL) : svm_predict(reduced, &problem->x[t]);
+        same += label == labels[t];
+    }
+    auto end_time = std::chrono::steady_clock::now();
+
+    svm_predictor_free(a);
+    svm_predictor_free(b);
+
+    double before = std::chrono::duration<double>(mid_time - start_time).count();
+    double after = std::chrono::duration<double>(end_time - mid_time).count();
+    *agreement = problem->l > 0 ? (double)same / problem->l : 1;
+    *speedup = after > 0 ? before / after : 1;
+}
+
+/**
+ * Approximates each decision function of a classification model with a subset
+ * of its SVs and new coefficients, so that the predictions change on at most
+ * `param.reduce_tol` of the training set. The SVs are selected greedily,
+ * refitting the decision values at the training points by least squares after
+ * each one. Returns NULL if the model is not a classifier or could not be
+ * reduced.
+ */
+struct svm_model* reduce_svm(struct svm_model const* model,
+                             struct svm_problem const* problem)
+{
+    svm_parameter const& param = model->param;
+    if (param.reduce_tol <= 0 || param.kernel_type == PRECOMPUTED ||
+        (param.svm_type != C_SVC && param.svm_type != NU_SVC) || model->l < 2)
+        return NULL;
+
+    int nr_class = model->nr_class;
+    std::vector<int> start(nr_class, 0);
+    for (int c = 1; c < nr_class; c++) {
+        start[c] = start[c - 1] + model->nSV[c - 1];
+    }
+
+    double tolerance = param.reduce_tol;
+    for (int attempt = 0; attempt < REDUCE_MAX_ATTEMPTS; attempt++, tolerance /= 2) {
+        std::vector<Reduced_Pair> pairs;
+        bool any = false;
+        int p = 0;
+        for (int i = 0; i < nr_class; i++) {
+            for (int j = i + 1; j < nr_class; j++, p++) {
+                pairs.push_back(reduce_pair(model, problem, i, j, p, start, tolerance));
+                any = any || pairs.back().reduced;
+            }
+        }
+        if (!any)
+            break;
+
+        svm_model* result = reduced_model(model, pairs, start);
+        if (result->l >= model->l) {
+            svm_free_and_destroy_model(&result);
+            break;
+        }
+
+        double agreement, speedup;
+        compare_models(model, result, problem, &agreement, &speedup);
+        DEBUG_LOG("reduce_svm: " << model->l << " -> " << result->l << " SVs, agreement "
+                  << agreement << ", speedup " << speedup << '\n');
+
+        if (1 - agreement <= param.reduce_tol) {
+            result->reduction.l = model->l;
+            result->reduction.agreement = agreement;
+            result->reduction.speedup = speedup;
+            return result;
+        }
+        svm_free_and_destroy_model(&result);
+    }
+
+    DEBUG_LOG("reduce_svm: keeping the " << model->l << " SVs\n");
+    return NULL;
+}
+
+/**
+ * Computes the per-dimension scaling selected by `param.standardize`, either
+ * mapping the PSP bounds onto [-1, 1] or the training points to zero mean and
+ * unit variance, and applies it to the points of the problem in place.
+ */
+Standardization standardize_problem(struct svm_problem* problem,
+                                    PSP_Result const& regions,
+                                    struct svm_parameter const& param)
+{
+    Standardization result;
+    int l = problem->l;
+
+    if (param.standardize == STANDARDIZE_NONE || l == 0)
+        return result;
+
+    int dim = problem->x[0].dim;
+    result.shift.assign(dim, 0.0);
+    result.scale.assign(dim, 1.0);
+
+    bool bounded = regions.xMin.size() == dim && regions.xMax.size() == dim;
+    if (param.standardize == STANDARDIZE_BOUNDS && bounded) {
+        for (int i = 0; i < dim; i++) {
+            double range = regions.xMax[i] - regions.xMin[i];
+            result.shift[i] = 0.5 * (regions.xMax[i] + regions.xMin[i]);
+            result.scale[i] = range > 0 ? 2 / range : 1;
+        }
+    } else {
+        std::vector<double> sqsum(dim, 0.0);
+        for (int k = 0; k < l; k++) {
+            for (int i = 0; i < dim; i++) {
+                double x = problem->x[k].values[i];
+                result.shift[i] += x;
+                sqsum[i] += x * x;
+            }
+        }
+        for (int i = 0; i < dim; i++) {
+            double mean = result.shift[i] / l;
+            double var = sqsum[i] / l - mean * mean;
+            result.shift[i] = mean;
+            result.scale[i] = var > 0 ? 1 / std::sqrt(var) : 1;
+        }
+    }
+
+    for (int k = 0; k < l; k++) {
+        for (int i = 0; i < dim; i++) {
+            double& x = problem->x[k].values[i];
+            x = (x - result.shift[i]) * result.scale[i];
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Makes a model trained on standardized points accept the original
+ * coordinates. Linear models from `train_linear_svm` absorb the scaling into
+ * their normal vector and offset, other models store it.
+ */
+void apply_standardization(struct svm_model* model,
+                           Standardization const& standardization)
+{
+    int dim = standardization.scale.size();
+
+    if (dim == 0)
+        return;
+
+    if (model->param.kernel_type == LINEAR && model->l == 1 && model->free_sv &&
+        model->sv_coef[0][0] == 1) {
+        double* w = model->SV[0].values;
+        for (int i = 0; i < dim; i++) {
+            w[i] *= standardization.scale[i];
+            model->rho[0] += w[i] * standardization.shift[i];
+        }
+        return;
+    }
+
+    model->nr_scale = dim;
+    model->x_shift = (double*)malloc(dim * sizeof(double));
+    model->x_scale = (double*)malloc(dim * sizeof(double));
+    std::copy(standardization.shift.begin(), standardization.shift.end(), model->x_shift);
+    std::copy(standardization.scale.begin(), standardization.scale.end(), model->x_scale);
+}
+
+struct svm_parameter svm_parameters(struct svm_parameter const* parameters)
+{
+    svm_parameter param = {};
+    if (!parameters) {
+        param.svm_type = NU_SVC;
+        param.kernel_type = POLY;
+        param.degree = 3;
+        param.gamma = 100;
+        param.cache_size = 100;
+        param.nu = 1e-6;
+        param.eps = 1e-3;
+        param.shrinking = 1;
+        param.linear_tol = 0;
+    } else {
+        param = *parameters;
+    }
+
+    return param;
+}
+
+/**
+ * Whether models trained with both parameter sets are interchangeable.
+ */
+bool same_parameters(struct svm_parameter const& a,
+                     struct svm_parameter const& b)
+{
+    if (a.svm_type != b.svm_type || a.kernel_type != b.kernel_type ||
+        a.degree != b.degree || a.gamma != b.gamma || a.coef0 != b.coef0 ||
+        a.eps != b.eps || a.C != b.C || a.nu != b.nu || a.p != b.p ||
+        a.shrinking != b.shrinking || a.probability != b.probability ||
+        a.coef_max != b.coef_max || a.max_retries != b.max_retries ||
+        a.min_SVs != b.min_SVs || a.linear_tol != b.linear_tol ||
+        a.standardize != b.standardize || a.max_iter != b.max_iter ||
+        a.max_time != b.max_time || a.eps_coarse != b.eps_coarse ||
+        a.reduce_tol != b.reduce_tol ||
+        a.nr_weight != b.nr_weight)
+        return false;
+
+    for (int i = 0; i < a.nr_weight; i++) {
+        if (a.weight_label[i] != b.weight_label[i] || a.weight[i] != b.weight[i])
+            return false;
+    }
+
+    return true;
+}
@@ -5,8 +5,37 @@
 #include "svm.h"
 
 #ifdef __cplusplus
+#include <vector>
+#include "psp_mcmc.h"
 
-struct svm_model* train_svm(const struct svm_problem* problem, struct svm_parameter& param);
+
+struct Standardization {
+    std::vector<double> shift;
+    std::vector<double> scale;
+
+    bool operator==(Standardization const& other) const
+    {
+        return shift == other.shift && scale == other.scale;
+    }
+};
+
+struct svm_parameter svm_parameters(struct svm_parameter const* parameters);
+bool same_parameters(struct svm_parameter const& a,
+                     struct svm_parameter const& b);
+struct svm_model* train_svm(const struct svm_problem* problem,
+                            struct svm_parameter& param,
+                            const struct svm_model* init = NULL,
+                            const int* init_index = NULL);
+struct svm_model* train_linear_svm(const struct svm_problem* problem,
+                                   struct svm_parameter const& param,
+                                   double* error_rate);
+struct svm_model* reduce_svm(struct svm_model const* model,
+                             struct svm_problem const* problem);
+Standardization standardize_problem(struct svm_problem* problem,
+                                    PSP_Result const& regions,
+                                    struct svm_parameter const& param);
+void apply_standardization(struct svm_model* model,
+                           Standardization const& standardization);
 
 #endif
 
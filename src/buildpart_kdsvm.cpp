@@ -1,23 +1,43 @@
+#include <algorithm>
+#include <cmath>
 #include <exception>
+#include <limits>
+#include <map>
 #include <numeric>
 
 #include "debug.h"
 #include "buildpart_kdsvm.h"
+#include "parallel.h"
+#include <Eigen/Cholesky>
 
 
 struct KdSVM_Internal : Node_Internal {
     using Node_Internal::Node_Internal;
-    PSP_KdSVMTree transformed;
+    PSP_KdSVMTree transformed = NULL;
     PSP_KdSVMTree_Data data;
     svm_problem problem;
+    // model with fewer SVs used for prediction, `data.model` being kept for
+    // warm starts
+    svm_model* reduced = NULL;
+
+    // training set of the node, for incremental updates: the regions of the
+    // left subtree come first in `indices`, followed by the right subtree
+    svm_parameter param;
+    std::vector<size_t> indices;
+    std::vector<Pattern> patterns;
+    std::vector<size_t> counts;
+    size_t split;
+    Standardization standardization;
 
     ~KdSVM_Internal();
 };
 using KdSVM_InternalPtr = std::shared_ptr<KdSVM_Internal>;
+using KdSVM_Nodes = std::map<std::vector<size_t>, KdSVM_InternalPtr>;
 
 KdSVM_Internal::~KdSVM_Internal()
 {
     delete transformed;
+    svm_free_and_destroy_model(&reduced);
     if (left != nullptr || right != nullptr) {
         svm_destroy_param(&data.model->param);
         svm_free_and_destroy_model(&data.model);
@@ -44,12 +64,16 @@ KdSVM_InternalPtr KdSVM_InternalPtr_Make(KdSVM_InternalPtr left,
 }
 
 static inline
-struct svm_model* build_svm(PSP_Result const& regions,
-                            std::vector<size_t>::const_iterator begin,
-                            std::vector<size_t>::const_iterator mid,
-                            std::vector<size_t>::const_iterator end,
-                            svm_parameter const* parameters,
-                            svm_problem* problem)
+void build_svm(PSP_Result const& regions,
+               std::vector<size_t>::const_iterator begin,
+               std::vector<size_t>::const_iterator mid,
+               std::vector<size_t>::const_iterator end,
+               svm_parameter const* parameters,
+               svm_problem* problem,
+               PSP_KdSVMTree_Data* data,
+               svm_model** reduced,
+               Standardization* standardization,
+               KdSVM_Internal const* prev)
 {
     DEBUG_LOG("SVM: { ");
     for (auto it = begin; it < mid; it++) {
@@ -63,19 +87,7 @@ struct svm_model* build_svm(PSP_Result const& regions,
 
     size_t dim = nDim(regions);
 
-    svm_parameter param = {};
-    if (!parameters) {
-        param.svm_type = NU_SVC;
-        param.kernel_type = POLY;
-        param.degree = 3;
-        param.gamma = 100;
-        param.cache_size = 100;
-        param.nu = 1e-6;
-        param.eps = 1e-3;
-        param.shrinking = 1;
-    } else {
-        param = *parameters;
-    }
+    svm_parameter param = svm_parameters(parameters);
 
     int num_points = 0;
     for (auto it = begin; it < end; it++) {
@@ -88,86 +100,324 @@ struct svm_model* build_svm(PSP_Result const& regions,
 
     int i = 0;
     for (auto it = begin; it < end; it++) {
-        for (auto & point : regions.xs[*it]) {
-            assert(i < num_points);
-
-            svm_node node;
-            node.dim = dim;
-            node.values = new double[dim];
-            Eigen::Map<Point>(node.values, dim) = point;
-
-            problem->x[i] = node;
-            problem->y[i] = it < mid ? 1 : -1;
-            i++;
-        }
+        regions.xs[*it].for_each_block([&](double const* rows, size_t count) {
+            for (size_t r = 0; r < count; r++) {
+                assert(i < num_points);
+
+                svm_node node;
+                node.dim = dim;
+                node.values = new double[dim];
+                std::copy(rows + r * dim, rows + (r + 1) * dim, node.values);
+
+                problem->x[i] = node;
+                problem->y[i] = it < mid ? 1 : -1;
+                i++;
+            }
+        });
     }
 
     const char* error_msg = svm_check_parameter(problem, &param);
     if (error_msg)
         throw std::invalid_argument(error_msg);
 
-    return train_svm(problem, param);
+    *standardization = standardize_problem(problem, regions, param);
+
+    // try a plain linear separator first
+    if (param.linear_tol >= 0) {
+        double error_rate;
+        svm_model* model = train_linear_svm(problem, param, &error_rate);
+        DEBUG_LOG("SVM: linear split training error " << error_rate << '\n');
+
+        if (error_rate <= param.linear_tol) {
+            apply_standardization(model, *standardization);
+            data->model = model;
+            data->split = PSP_KDSVM_SPLIT_LINEAR;
+            data->w = model->SV[0].values;
+            data->rho = model->rho[0];
+            return;
+        }
+
+        svm_free_and_destroy_model(&model);
+    }
+
+    // the regions are in the same order as in the previous training set, so
+    // its solution can be used as the starting point
+    std::vector<int> init_index;
+    if (prev && prev->split == (size_t)(mid - begin) &&
+        prev->standardization == *standardization) {
+        init_index.assign(num_points, -1);
+
+        int i = 0, offset = 0;
+        for (size_t q = 0; q < prev->counts.size(); q++) {
+            for (size_t k = 0; k < prev->counts[q]; k++) {
+                init_index[i + k] = offset + k;
+            }
+            i += regions.xs[begin[q]].size();
+            offset += prev->counts[q];
+        }
+    }
+
+    data->model = init_index.empty()
+                ? train_svm(problem, param)
+                : train_svm(problem, param, prev->data.model, init_index.data());
+    data->split = PSP_KDSVM_SPLIT_KERNEL;
+
+    *reduced = reduce_svm(data->model, problem);
+    if (*reduced)
+        apply_standardization(*reduced, *standardization);
+    apply_standardization(data->model, *standardization);
+}
+
+/**
+ * Sufficient statistics of the points sampled in a region, used to score
+ * candidate splits without touching the points themselves.
+ */
+struct Region_Stats {
+    double count;
+    Point sum;
+    Eigen::MatrixXd sqsum;
+    Point mean;
+};
+
+static inline
+std::vector<Region_Stats> region_stats(PSP_Result const& regions)
+{
+    size_t dim = nDim(regions);
+    std::vector<Region_Stats> stats;
+    stats.reserve(regions.patterns.size());
+
+    for (auto const& points : regions.xs) {
+        Region_Stats s = { 0, Point::Zero(dim), Eigen::MatrixXd::Zero(dim, dim) };
+        points.for_each([&](Eigen::Map<const Point> point) {
+            s.count++;
+            s.sum += point;
+            s.sqsum += point * point.transpose();
+        });
+        s.mean = s.count > 0 ? Point(s.sum / s.count) : Point::Zero(dim);
+        stats.push_back(std::move(s));
+    }
+
+    return stats;
+}
+
+// weight of the point/region imbalance of a split relative to its estimated
+// misclassification rate
+static const double SPLIT_BALANCE_WEIGHT = 0.1;
+// regularization added to the pooled covariance, relative to its trace
+static const double SPLIT_RIDGE = 1e-6;
+
+/**
+ * Scores the split of the regions into [0, k) and [k, n) as the expected error
+ * of the best linear separator between both sides, estimated from the
+ * Mahalanobis distance of their means under the pooled covariance, plus a
+ * penalty for unbalanced splits.
+ */
+static inline
+double split_score(Region_Stats const& a, size_t ka,
+                   Region_Stats const& b, size_t kb)
+{
+    double n = a.count + b.count;
+    if (a.count <= 0 || b.count <= 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    Point mean_a = a.sum / a.count;
+    Point mean_b = b.sum / b.count;
+    Eigen::MatrixXd scatter = a.sqsum - a.count * mean_a * mean_a.transpose()
+                            + b.sqsum - b.count * mean_b * mean_b.transpose();
+    scatter /= std::max(n - 2, 1.0);
+    scatter.diagonal().array() += SPLIT_RIDGE * std::max(scatter.trace(), 1e-12);
+
+    Point diff = mean_a - mean_b;
+    double dist2 = diff.dot(scatter.ldlt().solve(diff));
+    double error = 0.5 * std::erfc(std::sqrt(std::max(dist2, 0.0)) / (2 * M_SQRT2));
+
+    double imbalance = 0.5 * (std::abs(a.count - b.count) / n
+                              + std::abs((double)ka - (double)kb) / (ka + kb));
+
+    return error + SPLIT_BALANCE_WEIGHT * imbalance;
+}
+
+/**
+ * Chooses the axis-aligned partition of the regions in [begin, end) that is
+ * expected to be easiest to separate while keeping both sides balanced. The
+ * regions are reordered so that the first side is [begin, mid), and `mid` is
+ * returned.
+ */
+static inline
+std::vector<size_t>::iterator choose_split(std::vector<Region_Stats> const& stats,
+                                           std::vector<size_t>::iterator begin,
+                                           std::vector<size_t>::iterator end)
+{
+    size_t dims = stats[*begin].mean.size();
+    size_t n = end - begin;
+
+    double best_score = std::numeric_limits<double>::infinity();
+    size_t best_dim = 0;
+    size_t best_k = n / 2;
+
+    std::vector<size_t> order(begin, end);
+    for (size_t dim = 0; dim < dims; dim++) {
+        std::sort(order.begin(), order.end(), [&stats, dim](size_t lhs, size_t rhs) {
+            return stats[lhs].mean[dim] < stats[rhs].mean[dim];
+        });
+
+        // prefix sums of the statistics give both sides of every cut
+        Region_Stats total = { 0, Point::Zero(dims), Eigen::MatrixXd::Zero(dims, dims) };
+        for (size_t idx : order) {
+            total.count += stats[idx].count;
+            total.sum += stats[idx].sum;
+            total.sqsum += stats[idx].sqsum;
+        }
+
+        Region_Stats left = { 0, Point::Zero(dims), Eigen::MatrixXd::Zero(dims, dims) };
+        for (size_t k = 1; k < n; k++) {
+            Region_Stats const& s = stats[order[k - 1]];
+            left.count += s.count;
+            left.sum += s.sum;
+            left.sqsum += s.sqsum;
+
+            Region_Stats right = { total.count - left.count,
+                                   total.sum - left.sum,
+                                   total.sqsum - left.sqsum };
+
+            double score = split_score(left, k, right, n - k);
+            if (score < best_score) {
+                best_score = score;
+                best_dim = dim;
+                best_k = k;
+            }
+        }
+    }
+
+    DEBUG_LOG("KdSVM: split on axis " << best_dim << " at " << best_k << "/" << n
+              << ", score " << best_score << '\n');
+
+    std::sort(begin, end, [&stats, best_dim](size_t lhs, size_t rhs) {
+        return stats[lhs].mean[best_dim] < stats[rhs].mean[best_dim];
+    });
+
+    return begin + best_k;
+}
+
+/**
+ * Collects the nodes of a previously built tree that are still valid for the
+ * given regions, i.e. whose regions only received new samples since, keyed by
+ * the sorted indices of their regions.
+ */
+static inline
+void previous_nodes(PSP_Result const& regions,
+                    svm_parameter const& param,
+                    Node_InternalPtr const& node,
+                    KdSVM_Nodes& nodes)
+{
+    if (node == nullptr) {
+        return;
+    }
+
+    KdSVM_InternalPtr tree = std::static_pointer_cast<KdSVM_Internal>(node);
+
+    bool valid = same_parameters(tree->param, param);
+    for (size_t q = 0; valid && q < tree->indices.size(); q++) {
+        size_t idx = tree->indices[q];
+        valid = idx < regions.patterns.size()
+             && regions.patterns[idx] == tree->patterns[q]
+             && regions.xs[idx].size() >= tree->counts[q];
+    }
+
+    if (valid) {
+        std::vector<size_t> key(tree->indices);
+        std::sort(key.begin(), key.end());
+        nodes[key] = tree;
+    }
+
+    previous_nodes(regions, param, tree->left, nodes);
+    previous_nodes(regions, param, tree->right, nodes);
 }
 
 static inline
 KdSVM_InternalPtr build_kdsvm_internal(PSP_Result const& regions,
+                                       std::vector<Region_Stats> const& stats,
                                        std::vector<size_t>::iterator begin,
                                        std::vector<size_t>::iterator end,
                                        svm_parameter const* param,
-                                       size_t dim_ = 0)
+                                       KdSVM_Nodes const& prev_nodes)
 {
-    PSP_KdSVMTree_Data data;
+    PSP_KdSVMTree_Data data = {};
+    svm_model* reduced = NULL;
     KdSVM_InternalPtr left, right;
     svm_problem problem = {};
+    Standardization standardization;
+    std::vector<size_t>::iterator mid = end;
 
     if (begin >= end) {
         return KdSVM_InternalPtr_Make();
     }
 
+    // look for a node of the previous tree built on the same regions
+    KdSVM_InternalPtr prev;
+    {
+        std::vector<size_t> key(begin, end);
+        std::sort(key.begin(), key.end());
+        auto it = prev_nodes.find(key);
+        if (it != prev_nodes.end()) {
+            prev = it->second;
+        }
+    }
+
+    if (prev) {
+        bool untouched = true;
+        for (size_t q = 0; q < prev->indices.size(); q++) {
+            untouched = untouched && regions.xs[prev->indices[q]].size() == prev->counts[q];
+        }
+
+        if (untouched) {
+            DEBUG_LOG("KdSVM: no new samples, reusing subtree\n");
+            return prev;
+        }
+    }
+
     if (begin == end - 1) {
         data.pattern = regions.patterns[*begin];
 
         left = KdSVM_InternalPtr_Make();
         right = KdSVM_InternalPtr_Make();
     } else {
-#if 0
-        // select dimension - simply cycle it here
-        size_t dim = dim_ % nDim(regions);
-#else
-        // select dimension - find the longest bounding box edge
-        size_t dim;
-        double max_range = 0;
-
-        for (int i = 0; i < nDim(regions); i++) {
-            auto minmax = std::minmax_element(regions.xMean.begin(),
-                                              regions.xMean.end(),
-                                              [i](Point const &lhs, Point const &rhs)
-                                              { return lhs[i] < rhs[i]; });
-
-            double range = (*minmax.second)[i] - (*minmax.first)[i];
-            if (max_range < range) {
-                max_range = range;
-                dim = i;
-            }
+        if (prev) {
+            // keep the previous split, its subtrees may be reused
+            std::copy(prev->indices.begin(), prev->indices.end(), begin);
+            mid = begin + prev->split;
+        } else {
+            mid = choose_split(stats, begin, end);
         }
-#endif
-
-        // find median of points in the chosen dimension
-        auto mid = begin + (end - begin) / 2;
-        std::nth_element(begin, mid, end, [regions, dim](size_t lhs, size_t rhs) {
-            return regions.xMean[lhs][dim] < regions.xMean[rhs][dim];
-        });
 
         // build the separating plane
-        data.model = build_svm(regions, begin, mid, end, param, &problem);
-
-        left = build_kdsvm_internal(regions, begin, mid, param, dim + 1);
-        right = build_kdsvm_internal(regions, mid, end, param, dim + 1);
+        build_svm(regions, begin, mid, end, param, &problem, &data, &reduced, &standardization,
+                  prev.get());
+
+        // the subtrees only reorder their own regions, so they are built in
+        // parallel
+        parallel_for(2, [&](size_t side) {
+            if (side == 0) {
+                left = build_kdsvm_internal(regions, stats, begin, mid, param, prev_nodes);
+            } else {
+                right = build_kdsvm_internal(regions, stats, mid, end, param, prev_nodes);
+            }
+        });
     }
 
     KdSVM_InternalPtr result = KdSVM_InternalPtr_Make(left, right);
     result->data = data;
+    result->reduced = reduced;
     result->problem = problem;
+    result->param = svm_parameters(param);
+    result->indices.assign(begin, end);
+    for (auto it = begin; it < end; it++) {
+        result->patterns.push_back(regions.patterns[*it]);
+        result->counts.push_back(regions.xs[*it].size());
+    }
+    result->split = mid - begin;
+    result->standardization = standardization;
 
     return result;
 }
@@ -183,8 +433,12 @@ PSP_KdSVMTree transform_kdsvm(Node_InternalPtr const& kdsvm)
 
     PSP_KdSVMTree result = new PSP_KdSVMTreeRec;
     result->data = tree->data;
+    if (tree->reduced)
+        result->data.model = tree->reduced;
     result->node.left = (PSP_Node)transform_kdsvm(tree->left);
     result->node.right = (PSP_Node)transform_kdsvm(tree->right);
+    // reused nodes were part of the previous tree
+    delete tree->transformed;
     tree->transformed = result;
     return result;
 }
@@ -196,7 +450,68 @@ PSP_KdSVMTree build_kdsvm(PSP_Result data,
     std::vector<size_t> indices(data.patterns.size());
     std::iota(std::begin(indices), std::end(indices), 0);
 
-    memory->kdsvm = build_kdsvm_internal(data, std::begin(indices), std::end(indices), param);
+    std::vector<Region_Stats> stats = region_stats(data);
+
+    KdSVM_Nodes prev_nodes;
+    previous_nodes(data, svm_parameters(param), memory->kdsvm, prev_nodes);
+
+    memory->kdsvm = build_kdsvm_internal(data, stats, std::begin(indices), std::end(indices),
+                                         param, prev_nodes);
+    memory->retired_kdsvm = nullptr;
 
     return transform_kdsvm(memory->kdsvm);
 }
+
+static void node_stats(PSP_KdSVMTree tree,
+                       int depth,
+                       PSP_KdSVM_Node_StatsRec* stats,
+                       size_t max_nodes,
+                       size_t& num_nodes)
+{
+    if (!tree || !tree->node.left || !tree->node.right)
+        return;
+
+    if (num_nodes < max_nodes) {
+        PSP_KdSVM_Node_StatsRec& node = stats[num_nodes];
+        node = {};
+        node.depth = depth;
+        node.split = tree->data.split;
+        if (svm_model const* model = tree->data.model) {
+            node.num_SVs = model->l;
+            node.solver = model->stats;
+            node.reduction = model->reduction;
+        }
+    }
+    num_nodes++;
+
+    node_stats((PSP_KdSVMTree)tree->node.left, depth + 1, stats, max_nodes, num_nodes);
+    node_stats((PSP_KdSVMTree)tree->node.right, depth + 1, stats, max_nodes, num_nodes);
+}
+
+size_t kdsvm_node_stats(PSP_KdSVMTree tree,
+                        PSP_KdSVM_Node_StatsRec* stats,
+                        size_t max_nodes)
+{
+    size_t num_nodes = 0;
+    node_stats(tree, 0, stats, max_nodes, num_nodes);
+    return num_nodes;
+}
+
+size_t predict_kdsvm(PSP_KdSVMTree tree,
+                     const struct svm_node* x)
+{
+    while (tree->node.left && tree->node.right) {
+        PSP_KdSVMTree_Data const& data = tree->data;
+        bool left;
+
+        if (data.split == PSP_KDSVM_SPLIT_LINEAR) {
+            left = std::inner_product(x->values, x->values + x->dim, data.w, 0.0) > data.rho;
+        } else {
+            left = svm_predict(data.model, x) > 0;
+        }
+
+        tree = (PSP_KdSVMTree)(left ? tree->node.left : tree->node.right);
+    }
+
+    return tree->data.pattern;
+}
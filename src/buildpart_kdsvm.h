@@ -13,8 +13,19 @@ extern "C"
 {
 #endif
 
-typedef union PSP_KdSVMTree_Data_ {
+typedef enum PSP_KdSVMTree_Split_ {
+    PSP_KDSVM_SPLIT_KERNEL,
+    PSP_KDSVM_SPLIT_LINEAR
+} PSP_KdSVMTree_Split;
+
+typedef struct PSP_KdSVMTree_Data_ {
+    /* inner nodes: SVM separating the left and right subtrees */
     struct svm_model* model;
+    PSP_KdSVMTree_Split split;
+    /* linear splits: a point x belongs to the left subtree iff w.x > rho */
+    const double* w;
+    double rho;
+    /* leaves: the data pattern of the region */
     size_t pattern;
 } PSP_KdSVMTree_Data;
 
@@ -23,11 +34,27 @@ typedef struct PSP_KdSVMTreeRec_ {
     PSP_KdSVMTree_Data data;
 } PSP_KdSVMTreeRec, *PSP_KdSVMTree;
 
+/* training of an inner node of a KdSVM tree */
+typedef struct PSP_KdSVM_Node_StatsRec_ {
+    int depth;
+    PSP_KdSVMTree_Split split;
+    /* SVs of the model used for prediction */
+    int num_SVs;
+    struct svm_solver_stats solver;
+    struct svm_reduction_stats reduction;
+} PSP_KdSVM_Node_StatsRec, *PSP_KdSVM_Node_Stats;
+
 #ifdef __cplusplus
 }
 
 
 PSP_KdSVMTree build_kdsvm(PSP_Result data, svm_parameter const* param, PSP_Memory memory);
+size_t predict_kdsvm(PSP_KdSVMTree tree, const struct svm_node* x);
+/**
+ * Stores the statistics of the first `max_nodes` inner nodes of the tree, in
+ * depth-first order, and returns the number of inner nodes.
+ */
+size_t kdsvm_node_stats(PSP_KdSVMTree tree, PSP_KdSVM_Node_StatsRec* stats, size_t max_nodes);
 #endif
 
 #endif
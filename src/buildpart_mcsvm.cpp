@@ -1,4 +1,5 @@
 #include <exception>
+#include <vector>
 
 #include "debug.h"
 #include "buildpart_mcsvm.h"
@@ -6,9 +7,18 @@
 
 struct MCSVM_Internal : Node_Internal {
     using Node_Internal::Node_Internal;
-    PSP_MCSVM transformed;
-    svm_model* model;
-    svm_problem problem;
+    PSP_MCSVM transformed = NULL;
+    svm_model* model = NULL;
+    // model with fewer SVs used for prediction, `model` being kept for warm
+    // starts
+    svm_model* reduced = NULL;
+    svm_problem problem = {};
+
+    // training set of the model, for incremental updates
+    svm_parameter param;
+    std::vector<Pattern> patterns;
+    std::vector<size_t> counts;
+    Standardization standardization;
 
     ~MCSVM_Internal();
 };
@@ -17,6 +27,7 @@ using MCSVM_InternalPtr = std::shared_ptr<MCSVM_Internal>;
 MCSVM_Internal::~MCSVM_Internal()
 {
     delete transformed;
+    svm_free_and_destroy_model(&reduced);
     svm_destroy_param(&model->param);
     svm_free_and_destroy_model(&model);
     delete[] problem.y;
@@ -29,23 +40,14 @@ MCSVM_Internal::~MCSVM_Internal()
 static inline
 struct svm_model* build_svm(PSP_Result const& regions,
                             svm_parameter const* parameters,
-                            svm_problem* problem)
+                            svm_problem* problem,
+                            svm_model** reduced,
+                            Standardization* standardization,
+                            MCSVM_Internal const* prev)
 {
     size_t dim = nDim(regions);
 
-    svm_parameter param = {};
-    if (!parameters) {
-        param.svm_type = NU_SVC;
-        param.kernel_type = POLY;
-        param.degree = 3;
-        param.gamma = 100;
-        param.cache_size = 100;
-        param.nu = 1e-6;
-        param.eps = 1e-3;
-        param.shrinking = 1;
-    } else {
-        param = *parameters;
-    }
+    svm_parameter param = svm_parameters(parameters);
 
     int num_points = 0;
     for (size_t i = 0; i < regions.patterns.size(); i++) {
@@ -58,37 +60,108 @@ struct svm_model* build_svm(PSP_Result const& regions,
 
     int i = 0;
     for (size_t j = 0; j < regions.patterns.size(); j++) {
-        for (auto & point : regions.xs[j]) {
-            assert(i < num_points);
-
-            svm_node node;
-            node.dim = dim;
-            node.values = new double[dim];
-            Eigen::Map<Point>(node.values, dim) = point;
-
-            problem->x[i] = node;
-            problem->y[i] = regions.patterns[j];
-            i++;
-        }
+        regions.xs[j].for_each_block([&](double const* rows, size_t count) {
+            for (size_t r = 0; r < count; r++) {
+                assert(i < num_points);
+
+                svm_node node;
+                node.dim = dim;
+                node.values = new double[dim];
+                std::copy(rows + r * dim, rows + (r + 1) * dim, node.values);
+
+                problem->x[i] = node;
+                problem->y[i] = regions.patterns[j];
+                i++;
+            }
+        });
     }
 
     const char* error_msg = svm_check_parameter(problem, &param);
     if (error_msg)
         throw std::invalid_argument(error_msg);
 
-    return train_svm(problem, param);
+    *standardization = standardize_problem(problem, regions, param);
+
+    // points of the regions that were already sampled keep their index in the
+    // previous training set, so that its solution can be reused
+    std::vector<int> init_index;
+    if (prev && prev->standardization == *standardization) {
+        init_index.assign(num_points, -1);
+
+        int i = 0, offset = 0;
+        for (size_t j = 0; j < regions.patterns.size(); j++) {
+            int count = regions.xs[j].size();
+            int prev_count = j < prev->counts.size() ? prev->counts[j] : 0;
+            for (int k = 0; k < prev_count; k++) {
+                init_index[i + k] = offset + k;
+            }
+            i += count;
+            offset += prev_count;
+        }
+    }
+
+    svm_model* model = init_index.empty()
+                     ? train_svm(problem, param)
+                     : train_svm(problem, param, prev->model, init_index.data());
+
+    *reduced = reduce_svm(model, problem);
+    if (*reduced)
+        apply_standardization(*reduced, *standardization);
+    apply_standardization(model, *standardization);
+    return model;
+}
+
+/**
+ * Whether the regions only grew since the previous model was trained, i.e.
+ * after a search in APPEND or COMBINE mode.
+ */
+static inline
+bool extends(PSP_Result const& regions,
+             MCSVM_Internal const& prev)
+{
+    if (regions.patterns.size() < prev.patterns.size())
+        return false;
+
+    for (size_t j = 0; j < prev.patterns.size(); j++) {
+        if (regions.patterns[j] != prev.patterns[j] || regions.xs[j].size() < prev.counts[j])
+            return false;
+    }
+
+    return true;
+}
+
+static inline
+bool unchanged(PSP_Result const& regions,
+               MCSVM_Internal const& prev)
+{
+    if (regions.patterns.size() != prev.patterns.size())
+        return false;
+
+    for (size_t j = 0; j < prev.patterns.size(); j++) {
+        if (regions.xs[j].size() != prev.counts[j])
+            return false;
+    }
+
+    return true;
 }
 
 static inline
 MCSVM_InternalPtr build_mcsvm_internal(PSP_Result const& regions,
-                                       svm_parameter const* param)
+                                       svm_parameter const* param,
+                                       MCSVM_InternalPtr const& prev)
 {
     svm_problem problem = {};
 
     MCSVM_InternalPtr result = std::make_shared<MCSVM_Internal>(MCSVM_InternalPtr(),
                                                                 MCSVM_InternalPtr());
-    result->model = build_svm(regions, param, &problem);
+    result->model = build_svm(regions, param, &problem, &result->reduced, &result->standardization,
+                              prev.get());
     result->problem = problem;
+    result->param = svm_parameters(param);
+    result->patterns = regions.patterns;
+    for (auto const& points : regions.xs) {
+        result->counts.push_back(points.size());
+    }
 
     return result;
 }
@@ -103,7 +176,7 @@ PSP_MCSVM transform_mcsvm(Node_InternalPtr const& mcsvm)
     MCSVM_InternalPtr node = std::static_pointer_cast<MCSVM_Internal>(mcsvm);
 
     PSP_MCSVM result = new PSP_MCSVMRec{};
-    result->model = node->model;
+    result->model = node->reduced ? node->reduced : node->model;
     node->transformed = result;
     return result;
 }
@@ -112,7 +185,20 @@ PSP_MCSVM build_mcsvm(PSP_Result data,
                       svm_parameter const* param,
                       PSP_Memory memory)
 {
-    memory->mcsvm = build_mcsvm_internal(data, param);
+    MCSVM_InternalPtr prev = std::static_pointer_cast<MCSVM_Internal>(memory->mcsvm);
+
+    if (prev && !extends(data, *prev)) {
+        prev = nullptr;
+    }
+
+    if (prev && unchanged(data, *prev) && prev->transformed &&
+        same_parameters(prev->param, svm_parameters(param))) {
+        DEBUG_LOG("MCSVM: no new samples, reusing the previous model\n");
+        return prev->transformed;
+    }
+
+    memory->mcsvm = build_mcsvm_internal(data, param, prev);
+    memory->retired_mcsvm = nullptr;
 
     return transform_mcsvm(memory->mcsvm);
 }
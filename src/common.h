@@ -23,12 +23,18 @@ using Node_InternalPtr = std::shared_ptr<Node_Internal>;
 typedef struct PSP_MemoryRec {
     Node_InternalPtr kdsvm;
     Node_InternalPtr mcsvm;
+    // models that can no longer be reused, kept until the next build as the
+    // partitions returned from them are valid until then
+    Node_InternalPtr retired_kdsvm;
+    Node_InternalPtr retired_mcsvm;
 } *PSP_Memory;
 
 extern "C"
 {
 #endif
 
+typedef long Fixed;
+
 typedef struct PSP_NodeRec_ PSP_NodeRec, *PSP_Node;
 struct PSP_NodeRec_ {
     PSP_Node left;
@@ -37,6 +43,22 @@ struct PSP_NodeRec_ {
 
 #ifdef __cplusplus
 }
+
+
+/** Converts a coordinate from 16.16 fixed point */
+static inline
+double map_coord(Fixed coord)
+{
+    return coord / 65536.0;
+}
+
+/** Converts a coordinate to 16.16 fixed point, rounding toward zero */
+static inline
+Fixed unmap_coord(double coord)
+{
+    return (Fixed)(coord * 65536);
+}
+
 #endif
 
 #endif
@@ -0,0 +1,243 @@
+#include <cerrno>
+#include <fstream>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include "export_c.h"
+
+// name of the generated function
+static const char* EXPORT_FUNCTION = "psp_partition_predict";
+
+template <typename T>
+static inline
+void write_array(std::ostream& out,
+                 const char* type,
+                 std::string const& name,
+                 T const* values,
+                 size_t size)
+{
+    out << "static const " << type << " " << name << "[" << (size > 0 ? size : 1) << "] = {";
+    for (size_t i = 0; i < size; i++) {
+        out << (i % 4 == 0 ? "\n    " : " ") << values[i] << (i + 1 < size ? "," : "");
+    }
+    out << (size > 0 ? "\n};\n" : "0 };\n");
+}
+
+/**
+ * Writes the power with a constant exponent as the same sequence of products
+ * as `powi` in svm.cpp, so that the results are identical.
+ */
+static inline
+void write_powi(std::ostream& out,
+                std::string const& name,
+                int degree)
+{
+    out << "static double " << name << "(double base)\n{\n"
+        << "    double tmp = base, ret = 1.0;\n";
+    for (int t = degree; t > 0; t /= 2) {
+        if (t % 2 == 1)
+            out << "    ret *= tmp;\n";
+        out << "    tmp = tmp * tmp;\n";
+    }
+    out << "    (void)tmp;\n    return ret;\n}\n\n";
+}
+
+/**
+ * Writes the constants of a predictor and a function `psp_node_<n>` doing
+ * what `svm_predictor_predict` does, with the kernel specialized and the
+ * loop bounds constant.
+ */
+static void write_predictor(std::ostream& out,
+                            svm_predictor const* pred,
+                            size_t n,
+                            size_t input_dim)
+{
+    std::string id = std::to_string(n);
+    svm_parameter const& param = pred->param;
+    int dim = pred->dim;
+
+    if (pred->x_shift) {
+        write_array(out, "double", "psp_shift_" + id, pred->x_shift, dim);
+        write_array(out, "double", "psp_scale_" + id, pred->x_scale, dim);
+    }
+    write_array(out, "double", "psp_rho_" + id, pred->rho, pred->nr_dec);
+    if (pred->label)
+        write_array(out, "int", "psp_label_" + id, pred->label, pred->nr_class);
+
+    if (pred->nr_monomial > 0) {
+        write_array(out, "int", "psp_parent_" + id, pred->mono_parent, pred->nr_monomial);
+        write_array(out, "int", "psp_var_" + id, pred->mono_var, pred->nr_monomial);
+        write_array(out, "double", "psp_w_" + id, pred->w, (size_t)pred->nr_dec * pred->nr_monomial);
+    } else {
+        write_array(out, "double", "psp_sv_" + id, pred->SV, (size_t)pred->l * dim);
+        write_array(out, "double", "psp_coef_" + id, pred->coef, pred->nr_coef);
+        write_array(out, "int", "psp_start_" + id, pred->start, pred->nr_class);
+        write_array(out, "int", "psp_nsv_" + id, pred->nSV, pred->nr_class);
+        write_array(out, "int", "psp_coef_start_" + id, pred->coef_start, pred->nr_dec);
+        if (param.kernel_type == POLY)
+            write_powi(out, "psp_powi_" + id, param.degree);
+    }
+
+    out << "static double psp_node_" << id << "(const double* x)\n{\n"
+        << "    double px[" << dim << "];\n"
+        << "    double dec_values[" << pred->nr_dec << "];\n";
+    if (pred->nr_monomial > 0)
+        out << "    double monomial[" << pred->nr_monomial << "];\n";
+    else
+        out << "    double kvalue[" << pred->l << "];\n";
+    out << "    int i, j, k, p;\n\n";
+
+    // the input padded with zeros, as in svm_predictor_predict
+    out << "    for (k = 0; k < " << dim << "; k++)\n"
+        << "        px[k] = k < " << input_dim << " ? x[k] : 0;\n";
+    if (pred->x_shift) {
+        out << "    for (k = 0; k < " << dim << "; k++)\n"
+            << "        px[k] = (px[k] - psp_shift_" << id << "[k]) * psp_scale_" << id << "[k];\n";
+    }
+    out << "\n";
+
+    if (pred->nr_monomial > 0) {
+        int M = pred->nr_monomial;
+        out << "    monomial[0] = 1;\n"
+            << "    for (k = 1; k < " << M << "; k++)\n"
+            << "        monomial[k] = monomial[psp_parent_" << id << "[k]] * px[psp_var_" << id << "[k]];\n"
+            << "    for (p = 0; p < " << pred->nr_dec << "; p++) {\n"
+            << "        double sum = 0;\n"
+            << "        for (k = 0; k < " << M << "; k++)\n"
+            << "            sum += psp_w_" << id << "[p * " << M << " + k] * monomial[k];\n"
+            << "        dec_values[p] = sum - psp_rho_" << id << "[p];\n"
+            << "    }\n";
+    } else {
+        out << "    for (i = 0; i < " << pred->l << "; i++) {\n"
+            << "        const double* sv = psp_sv_" << id << " + i * " << dim << ";\n"
+            << "        double sum = 0;\n";
+        switch (param.kernel_type) {
+        case RBF:
+            out << "        for (k = 0; k < " << dim << "; k++) {\n"
+                << "            double d = px[k] - sv[k];\n"
+                << "            sum += d * d;\n"
+                << "        }\n"
+                << "        kvalue[i] = exp(" << -param.gamma << " * sum);\n";
+            break;
+        case LINEAR:
+            out << "        for (k = 0; k < " << dim << "; k++)\n"
+                << "            sum += px[k] * sv[k];\n"
+                << "        kvalue[i] = sum;\n";
+            break;
+        case POLY:
+            out << "        for (k = 0; k < " << dim << "; k++)\n"
+                << "            sum += px[k] * sv[k];\n"
+                << "        kvalue[i] = psp_powi_" << id << "(" << param.gamma << " * sum + "
+                << param.coef0 << ");\n";
+            break;
+        case SIGMOID:
+            out << "        for (k = 0; k < " << dim << "; k++)\n"
+                << "            sum += px[k] * sv[k];\n"
+                << "        kvalue[i] = tanh(" << param.gamma << " * sum + " << param.coef0 << ");\n";
+            break;
+        default:
+            throw std::invalid_argument("unsupported kernel type");
+        }
+        out << "    }\n\n"
+            << "    p = 0;\n"
+            << "    for (i = 0; i < " << pred->nr_class << " && p < " << pred->nr_dec << "; i++)\n"
+            << "        for (j = i + 1; j < " << pred->nr_class << " && p < " << pred->nr_dec << "; j++) {\n"
+            << "            const double* coef = psp_coef_" << id << " + psp_coef_start_" << id << "[p];\n"
+            << "            int ci = psp_nsv_" << id << "[i];\n"
+            << "            int cj = " << (pred->label ? "psp_nsv_" + id + "[j]" : std::string("0")) << ";\n"
+            << "            const double* ki = kvalue + psp_start_" << id << "[i];\n"
+            << "            const double* kj = kvalue + psp_start_" << id << "[j];\n"
+            << "            double sum = 0;\n"
+            << "            for (k = 0; k < ci; k++)\n"
+            << "                sum += coef[k] * ki[k];\n"
+            << "            for (k = 0; k < cj; k++)\n"
+            << "                sum += coef[ci + k] * kj[k];\n"
+            << "            dec_values[p] = sum - psp_rho_" << id << "[p];\n"
+            << "            p++;\n"
+            << "        }\n";
+    }
+
+    if (!pred->label) {
+        if (param.svm_type == ONE_CLASS)
+            out << "\n    (void)i; (void)j;\n    return dec_values[0] > 0 ? 1 : -1;\n}\n\n";
+        else
+            out << "\n    (void)i; (void)j;\n    return dec_values[0];\n}\n\n";
+        return;
+    }
+
+    int nr_class = pred->nr_class;
+    out << "\n    {\n"
+        << "        int vote[" << nr_class << "] = { 0 };\n"
+        << "        int best = 0;\n"
+        << "        p = 0;\n"
+        << "        for (i = 0; i < " << nr_class << "; i++)\n"
+        << "            for (j = i + 1; j < " << nr_class << "; j++)\n"
+        << "                ++vote[dec_values[p++] > 0 ? i : j];\n"
+        << "        for (i = 1; i < " << nr_class << "; i++)\n"
+        << "            if (vote[i] > vote[best])\n"
+        << "                best = i;\n"
+        << "        return psp_label_" << id << "[best];\n"
+        << "    }\n}\n\n";
+}
+
+/** Writes the branches of the subtree of a KdSVM partition rooted at node i */
+static void write_branches(std::ostream& out,
+                           PSP_Partition partition,
+                           size_t i,
+                           int depth)
+{
+    std::string indent(4 * depth, ' ');
+    PSP_Partition_Node const& node = partition->nodes[i];
+
+    if (!node.predictor) {
+        out << indent << "return " << node.pattern << ";\n";
+        return;
+    }
+
+    out << indent << "if (psp_node_" << i << "(x) > 0) {\n";
+    write_branches(out, partition, node.left, depth + 1);
+    out << indent << "} else {\n";
+    write_branches(out, partition, node.right, depth + 1);
+    out << indent << "}\n";
+}
+
+void export_c(PSP_Partition partition,
+              const char* path)
+{
+    if (partition->knn)
+        throw std::invalid_argument("nearest-neighbour partitions cannot be exported to C");
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out.precision(17);
+
+    out << "/* Generated by PSP: the data pattern of the region of a point of dimension "
+        << partition->dim << ". */\n\n"
+        << "#include <math.h>\n#include <stddef.h>\n\n";
+
+    for (size_t i = 0; i < partition->nodes.size(); i++) {
+        if (partition->nodes[i].predictor)
+            write_predictor(out, partition->nodes[i].predictor, i, partition->dim);
+    }
+
+    out << "size_t " << EXPORT_FUNCTION << "(const double* x)\n{\n";
+    if (partition->multiclass) {
+        out << "    return (size_t)psp_node_0(x);\n";
+    } else {
+        write_branches(out, partition, 0, 1);
+    }
+    out << "}\n";
+
+    std::ofstream file(path);
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), path);
+    file << out.str();
+    file.close();
+    if (!file)
+        throw std::system_error(errno ? errno : EIO, std::generic_category(), path);
+}
+
+/* EOF */
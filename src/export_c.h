@@ -0,0 +1,20 @@
+#ifndef EXPORT_C_H
+#define EXPORT_C_H
+
+#include "partition.h"
+
+#ifdef __cplusplus
+#include <system_error>
+
+/**
+ * Writes C source code predicting like the partition, see `PSP_Export_C`.
+ * Throws std::invalid_argument for nearest-neighbour partitions and
+ * std::system_error if the file cannot be written.
+ */
+void export_c(PSP_Partition partition, const char* path);
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,113 @@
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include "job_pool.h"
+#include "parallel.h"
+
+PSP_Job_Pool_::PSP_Job_Pool_(size_t num_threads)
+: stopping(false)
+{
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        try {
+            threads.emplace_back(&PSP_Job_Pool_::work, this);
+        } catch (std::system_error const&) {
+            // run with the threads we got
+            if (threads.empty())
+                throw;
+            break;
+        }
+    }
+}
+
+PSP_Job_Pool_::~PSP_Job_Pool_()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (PSP_Job job : jobs) {
+        delete job;
+    }
+}
+
+PSP_Job PSP_Job_Pool_::submit(PSP_Handle_* handle,
+                              PSP_Job_Func run,
+                              void* job_context)
+{
+    std::unique_ptr<PSP_Job_> job(new PSP_Job_{ handle, run, job_context, 0, false });
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Handle_Queue& queue = queues[handle];
+        queue.pending.push_back(job.get());
+        jobs.insert(job.get());
+        if (!queue.running && queue.pending.size() == 1) {
+            ready.push_back(handle);
+        }
+    }
+    available.notify_one();
+
+    return job.release();
+}
+
+int PSP_Job_Pool_::wait(PSP_Job job)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (jobs.count(job) == 0)
+        throw std::invalid_argument("not a job of the pool");
+
+    finished.wait(lock, [job]() { return job->done; });
+    int result = job->result;
+    jobs.erase(job);
+    delete job;
+
+    return result;
+}
+
+void PSP_Job_Pool_::work()
+{
+    Thread_Limit limit(1);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        available.wait(lock, [this]() { return stopping || !ready.empty(); });
+        if (ready.empty())
+            return;
+
+        PSP_Handle_* handle = ready.front();
+        ready.pop_front();
+        Handle_Queue& queue = queues[handle];
+        PSP_Job job = queue.pending.front();
+        queue.pending.pop_front();
+        queue.running = true;
+
+        lock.unlock();
+        int result = job->run(job->handle, job->job_context);
+        lock.lock();
+
+        job->result = result;
+        job->done = true;
+
+        // the handle waits for its turn behind the others
+        Handle_Queue& after = queues[handle];
+        if (after.pending.empty()) {
+            queues.erase(handle);
+        } else {
+            after.running = false;
+            ready.push_back(handle);
+            available.notify_one();
+        }
+        finished.notify_all();
+    }
+}
+
+/* EOF */
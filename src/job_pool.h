@@ -0,0 +1,87 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#ifdef __cplusplus
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+extern "C"
+{
+#endif
+
+struct PSP_Handle_;
+
+/**
+ * Runs a job on a handle, e.g. a search followed by the building of a
+ * partition, and returns 0 or an error code.
+ */
+typedef int (*PSP_Job_Func)(struct PSP_Handle_* handle,
+                            void* job_context);
+
+typedef struct PSP_Job_ *PSP_Job;
+typedef struct PSP_Job_Pool_ *PSP_Job_Pool;
+
+#ifdef __cplusplus
+}
+
+
+struct PSP_Job_ {
+    PSP_Handle_* handle;
+    PSP_Job_Func run;
+    void* job_context;
+    int result;
+    bool done;
+};
+
+/**
+ * A fixed set of threads running the jobs of many handles. The jobs of a
+ * handle are run one at a time, in the order they were submitted; the
+ * threads take the next job of each handle in turn, so that a handle with
+ * many jobs does not delay the others. The parallel stages of a job run on
+ * the thread of the job, so that the pool bounds the threads of all jobs.
+ */
+struct PSP_Job_Pool_ {
+    explicit PSP_Job_Pool_(size_t num_threads);
+    PSP_Job_Pool_(PSP_Job_Pool_ const& other) = delete;
+    PSP_Job_Pool_ & operator=(PSP_Job_Pool_ const& other) = delete;
+    /** Runs the remaining jobs and frees those not waited for */
+    ~PSP_Job_Pool_();
+
+    PSP_Job submit(PSP_Handle_* handle, PSP_Job_Func run, void* job_context);
+    /**
+     * Waits for a job of the pool to be done, frees it and returns its
+     * result. Throws std::invalid_argument if it is not a job of the pool.
+     */
+    int wait(PSP_Job job);
+
+private:
+    struct Handle_Queue {
+        std::deque<PSP_Job> pending;
+        bool running = false;
+    };
+
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable finished;
+    // handles with a job to run and none running, in the order they are served
+    std::deque<PSP_Handle_*> ready;
+    std::unordered_map<PSP_Handle_*, Handle_Queue> queues;
+    // jobs not waited for yet
+    std::unordered_set<PSP_Job> jobs;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+#include "debug.h"
+#include "lookup_grid.h"
+
+// largest depth, so that the products giving the cell coordinates of a point
+// fit in 64 bits
+static const int LOOKUP_MAX_DEPTH = 16;
+// largest dimension, as every node has 2^dim children
+static const size_t LOOKUP_MAX_DIM = 16;
+
+struct Lookup_Cell {
+    size_t node;
+    int depth;
+    // integer coordinates of the cell among the 2^depth cells of each dimension
+    std::vector<uint64_t> coord;
+};
+
+/**
+ * Appends the points at which the partition is checked in a cell: its
+ * corners, then `num_samples` uniformly distributed points.
+ */
+static inline
+void check_points(PSP_Lookup_GridRec_ const& grid,
+                  Lookup_Cell const& cell,
+                  int num_samples,
+                  std::mt19937_64& generator,
+                  std::vector<Fixed>& points)
+{
+    size_t dim = grid.dim;
+    std::vector<double> lower(dim), upper(dim);
+    for (size_t i = 0; i < dim; i++) {
+        double range = (double)(grid.x_max[i] - grid.x_min[i]) / ((uint64_t)1 << cell.depth);
+        lower[i] = grid.x_min[i] + range * cell.coord[i];
+        upper[i] = lower[i] + range;
+    }
+
+    for (size_t corner = 0; corner < ((size_t)1 << dim); corner++) {
+        for (size_t i = 0; i < dim; i++) {
+            points.push_back((Fixed)((corner >> i) & 1 ? upper[i] : lower[i]));
+        }
+    }
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int s = 0; s < num_samples; s++) {
+        for (size_t i = 0; i < dim; i++) {
+            points.push_back((Fixed)(lower[i] + (upper[i] - lower[i]) * uniform(generator)));
+        }
+    }
+}
+
+PSP_Lookup_Grid build_lookup_grid(PSP_Partition partition,
+                                  Fixed const* x_min,
+                                  Fixed const* x_max,
+                                  int max_depth,
+                                  int num_samples)
+{
+    size_t dim = partition->dim;
+
+    if (max_depth < 0 || max_depth > LOOKUP_MAX_DEPTH)
+        throw std::invalid_argument("the depth of a lookup grid must be between 0 and 16");
+    if (dim == 0 || dim > LOOKUP_MAX_DIM)
+        throw std::invalid_argument("lookup grids support 1 to 16 dimensions");
+    if (num_samples < 0)
+        throw std::invalid_argument("negative number of samples");
+
+    std::unique_ptr<PSP_Lookup_GridRec_> grid(new PSP_Lookup_GridRec_);
+    grid->dim = dim;
+    grid->max_depth = max_depth;
+    grid->x_min.assign(x_min, x_min + dim);
+    grid->x_max.assign(x_max, x_max + dim);
+    grid->x.resize(dim);
+    grid->partition.reset(copy_partition(partition));
+
+    for (size_t i = 0; i < dim; i++) {
+        if (x_max[i] <= x_min[i])
+            throw std::invalid_argument("empty lookup grid bounds");
+        grid->scale.push_back(((uint64_t)1 << (max_depth + 32)) / (uint64_t)(x_max[i] - x_min[i]));
+    }
+
+    size_t num_children = (size_t)1 << dim;
+    size_t num_checks = num_children + num_samples;
+    std::mt19937_64 generator(0);
+
+    grid->nodes.push_back({0, LOOKUP_MIXED});
+    std::vector<Lookup_Cell> level = { {0, 0, std::vector<uint64_t>(dim, 0)} };
+    size_t num_uniform = 0, num_mixed = 0;
+
+    // the cells of each level are checked together
+    while (!level.empty()) {
+        std::vector<Fixed> points;
+        points.reserve(level.size() * num_checks * dim);
+        for (auto const& cell : level) {
+            check_points(*grid, cell, num_samples, generator, points);
+        }
+
+        std::vector<size_t> patterns(level.size() * num_checks);
+        predict_batch(grid->partition.get(), patterns.size(), points.data(), patterns.data(), 0);
+
+        std::vector<Lookup_Cell> next;
+        for (size_t c = 0; c < level.size(); c++) {
+            Lookup_Cell const& cell = level[c];
+            auto first = patterns.begin() + c * num_checks;
+            bool uniform = std::all_of(first, first + num_checks, [&](size_t p) { return p == *first; });
+
+            if (uniform) {
+                grid->nodes[cell.node].pattern = *first;
+                num_uniform++;
+            } else if (cell.depth == max_depth) {
+                num_mixed++;
+            } else {
+                if (grid->nodes.size() + num_children > UINT32_MAX)
+                    throw std::bad_alloc();
+
+                grid->nodes[cell.node].child = grid->nodes.size();
+                for (size_t k = 0; k < num_children; k++) {
+                    Lookup_Cell child = { grid->nodes.size(), cell.depth + 1, cell.coord };
+                    for (size_t i = 0; i < dim; i++) {
+                        child.coord[i] = 2 * child.coord[i] + ((k >> i) & 1);
+                    }
+                    grid->nodes.push_back({0, LOOKUP_MIXED});
+                    next.push_back(std::move(child));
+                }
+            }
+        }
+
+        level.swap(next);
+    }
+
+    DEBUG_LOG("Lookup grid: " << grid->nodes.size() << " nodes, " << num_uniform
+              << " uniform cells, " << num_mixed << " mixed cells\n");
+
+    return grid.release();
+}
+
+size_t lookup_grid(PSP_Lookup_Grid grid,
+                   Fixed const* point)
+{
+    size_t dim = grid->dim;
+    int max_depth = grid->max_depth;
+    uint64_t q[LOOKUP_MAX_DIM];
+    uint64_t q_max = ((uint64_t)1 << max_depth) - 1;
+    bool inside = true;
+
+    for (size_t i = 0; i < dim; i++) {
+        inside = inside && point[i] >= grid->x_min[i] && point[i] <= grid->x_max[i];
+        q[i] = std::min(((uint64_t)(point[i] - grid->x_min[i]) * grid->scale[i]) >> 32, q_max);
+    }
+
+    if (inside) {
+        PSP_Lookup_Grid_Node const* node = &grid->nodes[0];
+        for (int shift = max_depth - 1; node->child; shift--) {
+            size_t k = 0;
+            for (size_t i = 0; i < dim; i++) {
+                k |= ((q[i] >> shift) & 1) << i;
+            }
+            node = &grid->nodes[node->child + k];
+        }
+
+        if (node->pattern != LOOKUP_MIXED)
+            return node->pattern;
+    }
+
+    for (size_t i = 0; i < dim; i++) {
+        grid->x[i] = map_coord(point[i]);
+    }
+    svm_node x = { (int)dim, grid->x.data() };
+    return predict_partition(grid->partition.get(), &x);
+}
+
+/* EOF */
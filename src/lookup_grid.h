@@ -0,0 +1,64 @@
+#ifndef LOOKUP_GRID_H
+#define LOOKUP_GRID_H
+
+#include "common.h"
+#include "partition.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+extern "C"
+{
+#endif
+
+typedef struct PSP_Lookup_GridRec_ *PSP_Lookup_Grid;
+
+#ifdef __cplusplus
+}
+
+
+struct PSP_Lookup_Grid_Node {
+    // inner nodes: index of the first of the 2^dim children, 0 for leaves
+    uint32_t child;
+    // leaves: the data pattern of the cell, or `LOOKUP_MIXED`
+    size_t pattern;
+};
+
+/**
+ * An adaptive 2^dim-tree over a box, whose leaves are cells found uniform by
+ * a partition or mixed cells at the maximum depth. The children of a node
+ * are numbered by the bits of their halves along each dimension.
+ *
+ * A point is mapped to integer cell coordinates `q[i]` in [0, 2^max_depth)
+ * with a multiplication and a shift, the child taken at depth k being given
+ * by bit max_depth - 1 - k of each `q[i]`.
+ */
+struct PSP_Lookup_GridRec_ {
+    size_t dim;
+    int max_depth;
+    std::vector<Fixed> x_min;
+    std::vector<Fixed> x_max;
+    // q[i] = ((x[i] - x_min[i]) * scale[i]) >> 32
+    std::vector<uint64_t> scale;
+    std::vector<PSP_Lookup_Grid_Node> nodes;
+    std::unique_ptr<PSP_PartitionRec_> partition;
+    // scratch point for the partition, in mixed cells
+    std::vector<double> x;
+};
+
+static const size_t LOOKUP_MIXED = (size_t)-1;
+
+PSP_Lookup_Grid build_lookup_grid(PSP_Partition partition,
+                                  Fixed const* x_min,
+                                  Fixed const* x_max,
+                                  int max_depth,
+                                  int num_samples);
+size_t lookup_grid(PSP_Lookup_Grid grid, Fixed const* point);
+#endif
+
+#endif
+
+/* EOF */
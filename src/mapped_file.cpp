@@ -0,0 +1,96 @@
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+Mapped_File map_file(const char* path,
+                     const char* kind,
+                     uint64_t min_size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    if ((uint64_t)st.st_size < min_size || st.st_size == 0) {
+        close(fd);
+        throw std::invalid_argument(std::string("not a ") + kind);
+    }
+
+    size_t size = st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::system_error(err, std::generic_category(), path);
+
+    Mapped_File file;
+    file.mapping = std::shared_ptr<const void>(data, [size](const void* p) {
+        munmap(const_cast<void*>(p), size);
+    });
+    file.data = static_cast<char const*>(data);
+    file.size = size;
+    file.kind = kind;
+    return file;
+}
+
+Mapped_File spill_file(const char* dir,
+                       Spill_Part const* parts,
+                       size_t num_parts)
+{
+    std::string name = std::string(dir) + "/psp-segment-XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), dir);
+    unlink(path.data());
+
+    uint64_t size = 0;
+    for (size_t p = 0; p < num_parts; p++) {
+        char const* bytes = static_cast<char const*>(parts[p].data);
+        for (uint64_t written = 0; written < parts[p].size; ) {
+            ssize_t n = write(fd, bytes + written, parts[p].size - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                int err = n < 0 ? errno : EIO;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), dir);
+            }
+            written += n;
+        }
+        size += parts[p].size;
+    }
+
+    void* mapped = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    int err = errno;
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::system_error(err, std::generic_category(), dir);
+
+    Mapped_File file;
+    if (mapped) {
+        file.mapping = std::shared_ptr<const void>(mapped, [size](const void* p) {
+            munmap(const_cast<void*>(p), size);
+        });
+    }
+    file.data = static_cast<char const*>(mapped);
+    file.size = size;
+    file.kind = "segment file";
+    return file;
+}
+
+/* EOF */
@@ -0,0 +1,66 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+/**
+ * A file mapped read-only into memory, with bounds-checked access to the
+ * arrays in it. The file stays mapped while a copy of `mapping` exists.
+ */
+struct Mapped_File {
+    std::shared_ptr<const void> mapping;
+    char const* data;
+    uint64_t size;
+    // kind of file, for error messages
+    std::string kind;
+
+    /**
+     * Returns the array of `count` elements at `offset`, throwing
+     * std::invalid_argument if it is not aligned or not in the file.
+     */
+    template <typename T>
+    T const* array(uint64_t offset, uint64_t count) const
+    {
+        if (offset % alignof(T) != 0 || offset > size || count > (size - offset) / sizeof(T))
+            throw std::invalid_argument("corrupt " + kind);
+        return reinterpret_cast<T const*>(data + offset);
+    }
+
+    /** Same as `array`, but returns NULL for offset 0 */
+    template <typename T>
+    T const* optional_array(uint64_t offset, uint64_t count) const
+    {
+        return offset ? array<T>(offset, count) : NULL;
+    }
+};
+
+/**
+ * Maps a file of the given kind. Throws std::system_error if it cannot be
+ * mapped, and std::invalid_argument if it is smaller than `min_size`.
+ */
+Mapped_File map_file(const char* path, const char* kind, uint64_t min_size);
+
+/** Bytes written to a segment file */
+struct Spill_Part {
+    void const* data;
+    uint64_t size;
+};
+
+/**
+ * Writes the given parts one after the other to a new file in the directory
+ * `dir` and maps it. The file is unlinked at once, so that it is removed when
+ * it is unmapped, even if the process ends abruptly. Throws std::system_error
+ * if the file cannot be written or mapped.
+ */
+Mapped_File spill_file(const char* dir, Spill_Part const* parts, size_t num_parts);
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+// limit of the threads of `parallel_for` on this thread, 0 if none
+static thread_local size_t thread_limit = 0;
+// executor of the tasks of `parallel_for` on this thread, the pool if none
+static thread_local PSP_ExecutorRec current_executor = { NULL, NULL };
+
+/**
+ * The threads running the tasks of `parallel_for` when no executor is set,
+ * started on first use and stopped at exit.
+ */
+class Default_Pool {
+public:
+    Default_Pool()
+    : stopping(false)
+    {
+        size_t num_threads = std::max<size_t>(default_num_threads(), 2) - 1;
+        for (size_t t = 0; t < num_threads; t++) {
+            try {
+                threads.emplace_back(&Default_Pool::work, this);
+            } catch (std::system_error const&) {
+                // run with the threads we got
+                break;
+            }
+        }
+    }
+
+    ~Default_Pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void submit(PSP_Task_Func task,
+                void* task_context)
+    {
+        if (threads.empty()) {
+            task(task_context);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(task, task_context);
+        }
+        available.notify_one();
+    }
+
+private:
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping)
+                return;
+
+            auto task = tasks.front();
+            tasks.pop_front();
+            lock.unlock();
+            task.first(task.second);
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::pair<PSP_Task_Func, void*>> tasks;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+static void default_submit(void*,
+                           PSP_Task_Func task,
+                           void* task_context)
+{
+    static Default_Pool pool;
+    pool.submit(task, task_context);
+}
+
+/**
+ * The iterations of a `parallel_for`, shared with its tasks. Tasks that
+ * start once the loop is closed return at once, so that the calling thread
+ * only waits for the tasks running.
+ */
+struct Parallel_Loop {
+    size_t n;
+    std::function<void(size_t)> const* body;
+    PSP_ExecutorRec executor;
+    std::atomic<size_t> next;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+    size_t active;
+    bool closed;
+    std::exception_ptr error;
+
+    void work()
+    {
+        size_t i;
+        while ((i = next++) < n) {
+            try {
+                (*body)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = n;
+            }
+        }
+    }
+};
+
+static void run_task(void* task_context)
+{
+    std::unique_ptr<std::shared_ptr<Parallel_Loop>> context(
+        static_cast<std::shared_ptr<Parallel_Loop>*>(task_context));
+    Parallel_Loop& loop = **context;
+
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        if (loop.closed)
+            return;
+        loop.active++;
+    }
+
+    {
+        Executor_Scope scope(loop.executor);
+        loop.work();
+    }
+
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    loop.active--;
+    loop.idle.notify_all();
+}
+
+
+size_t default_num_threads()
+{
+    size_t num_threads = std::thread::hardware_concurrency();
+    return num_threads > 0 ? num_threads : 1;
+}
+
+void parallel_for(size_t n,
+                  std::function<void(size_t)> const& body,
+                  size_t num_threads)
+{
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (thread_limit > 0) {
+        num_threads = std::min(num_threads, thread_limit);
+    }
+    num_threads = std::min(num_threads, n);
+
+    auto loop = std::make_shared<Parallel_Loop>();
+    loop->n = n;
+    loop->body = &body;
+    loop->executor = current_executor;
+    loop->next = 0;
+    loop->active = 0;
+    loop->closed = false;
+
+    PSP_ExecutorRec executor = current_executor.submit
+                             ? current_executor
+                             : PSP_ExecutorRec{ NULL, default_submit };
+    for (size_t t = 1; t < num_threads; t++) {
+        std::unique_ptr<std::shared_ptr<Parallel_Loop>> context;
+        try {
+            context.reset(new std::shared_ptr<Parallel_Loop>(loop));
+            executor.submit(executor.executor_context, run_task, context.get());
+            context.release();
+        } catch (...) {
+            // run with the tasks we got
+            break;
+        }
+    }
+
+    loop->work();
+
+    {
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->closed = true;
+        loop->idle.wait(lock, [&loop]() { return loop->active == 0; });
+    }
+
+    if (loop->error) {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+Thread_Limit::Thread_Limit(size_t max_threads)
+: previous(thread_limit)
+{
+    thread_limit = previous > 0 ? std::min(previous, max_threads) : max_threads;
+}
+
+Thread_Limit::~Thread_Limit()
+{
+    thread_limit = previous;
+}
+
+Executor_Scope::Executor_Scope(PSP_ExecutorRec const& executor)
+: previous(current_executor)
+{
+    current_executor = executor;
+}
+
+Executor_Scope::~Executor_Scope()
+{
+    current_executor = previous;
+}
+
+/* EOF */
@@ -0,0 +1,86 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <functional>
+
+
+extern "C"
+{
+#endif
+
+typedef void (*PSP_Task_Func)(void* task_context);
+
+/**
+ * Runs `task(task_context)` once, on any thread, now or later. The task may
+ * also be run before the function returns.
+ */
+typedef void (*PSP_Submit_Func)(void* executor_context,
+                                PSP_Task_Func task,
+                                void* task_context);
+
+typedef struct PSP_ExecutorRec_ {
+    void* executor_context;
+    PSP_Submit_Func submit;
+} PSP_ExecutorRec, *PSP_Executor;
+
+#ifdef __cplusplus
+}
+
+
+/** Number of threads used by default, one per hardware thread. */
+size_t default_num_threads();
+
+/**
+ * Calls `body(i)` for every i in [0, n) on up to `num_threads` threads,
+ * including the calling thread, or `default_num_threads()` if 0. The other
+ * threads are those of the executor in scope, or of a pool of the library
+ * if none. Iterations are claimed one at a time in increasing order, and the
+ * calling thread only waits for the tasks that started, so that it does not
+ * depend on the executor having a free thread. If an iteration throws, the
+ * iterations not yet claimed are skipped and the first exception is rethrown
+ * once all threads stopped.
+ */
+void parallel_for(size_t n,
+                  std::function<void(size_t)> const& body,
+                  size_t num_threads = 0);
+
+/**
+ * Limits the threads used by `parallel_for` when called from the current
+ * thread, including itself, while in scope. The threads of a job pool run
+ * their jobs under a limit, so that the parallel stages of concurrent jobs
+ * do not start more threads than the pool has.
+ */
+class Thread_Limit {
+public:
+    explicit Thread_Limit(size_t max_threads);
+    Thread_Limit(Thread_Limit const& other) = delete;
+    Thread_Limit & operator=(Thread_Limit const& other) = delete;
+    ~Thread_Limit();
+
+private:
+    size_t previous;
+};
+
+/**
+ * Runs the tasks of `parallel_for` called from the current thread, and from
+ * its tasks, with the given executor while in scope, or with the pool of the
+ * library if its `submit` is NULL.
+ */
+class Executor_Scope {
+public:
+    explicit Executor_Scope(PSP_ExecutorRec const& executor);
+    Executor_Scope(Executor_Scope const& other) = delete;
+    Executor_Scope & operator=(Executor_Scope const& other) = delete;
+    ~Executor_Scope();
+
+private:
+    PSP_ExecutorRec previous;
+};
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,862 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+
+#include "debug.h"
+#include "parallel.h"
+#include "partition.h"
+
+// number of points predicted together by `predict_batch`
+static const size_t BATCH_BLOCK = 128;
+// largest number of samples in a leaf of a nearest-neighbour tree
+static const size_t KNN_LEAF_SIZE = 16;
+// largest number of neighbours voting
+static const size_t KNN_MAX_K = 64;
+
+using Matrix_RowMajor = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+struct Batch_Workspace {
+    Matrix_RowMajor x;
+    Eigen::MatrixXd kvalue;
+    Eigen::MatrixXd dec;
+    std::vector<double> result;
+};
+
+struct Flat_Workspace {
+    std::vector<double> x;
+    std::vector<double> dec;
+    std::vector<double> dot;
+    std::vector<double> x_square;
+    std::vector<double> monomial;
+    std::vector<int> node;
+    std::vector<size_t> active;
+    std::vector<size_t> next;
+};
+
+
+PSP_PartitionRec_::~PSP_PartitionRec_()
+{
+    for (auto& node : nodes) {
+        svm_predictor_free(node.predictor);
+    }
+}
+
+static inline
+svm_predictor* make_predictor(svm_model const* model)
+{
+    svm_predictor* predictor = svm_predictor_create(model);
+    if (!predictor)
+        throw std::bad_alloc();
+    return predictor;
+}
+
+/** Points the flat layout of a partition to its `flat_*` vectors */
+static inline
+void view_flat(PSP_PartitionRec_& partition)
+{
+    partition.flat.dim = partition.dim;
+    partition.flat.num_nodes = partition.flat_nodes.size();
+    partition.flat.nodes = partition.flat_nodes.data();
+    partition.flat.num_values = partition.flat_values.size();
+    partition.flat.values = partition.flat_values.data();
+    partition.flat.num_indices = partition.flat_indices.size();
+    partition.flat.indices = partition.flat_indices.data();
+}
+
+/**
+ * Packs the predictors of a compiled KdSVM tree into its flat layout. Every
+ * node gets the dimension of the partition: the SVs are padded with zeros,
+ * and nodes of a lower dimension are scaled by zero on the extra coordinates.
+ * The signs are set so that a positive decision value goes left.
+ */
+static void flatten_kdsvm(PSP_PartitionRec_& partition)
+{
+    size_t dim = partition.dim;
+    std::vector<double>& values = partition.flat_values;
+    std::vector<int>& indices = partition.flat_indices;
+
+    for (auto const& node : partition.nodes) {
+        PSP_Flat_NodeRec flat = {};
+        svm_predictor const* pred = node.predictor;
+
+        if (!pred) {
+            flat.left = flat.right = -1;
+            flat.pattern = node.pattern;
+            partition.flat_nodes.push_back(flat);
+            continue;
+        }
+
+        flat.left = (int)node.left;
+        flat.right = (int)node.right;
+        flat.kernel_type = pred->param.kernel_type;
+        flat.degree = pred->param.degree;
+        flat.gamma = pred->param.gamma;
+        flat.coef0 = pred->param.coef0;
+
+        double sign = pred->label && pred->label[0] < 0 ? -1.0 : 1.0;
+        size_t pred_dim = pred->dim;
+        flat.rho = sign * pred->rho[0];
+
+        flat.scaled = pred->x_shift || pred_dim < dim;
+        if (flat.scaled) {
+            flat.shift = values.size();
+            for (size_t k = 0; k < dim; k++) {
+                values.push_back(pred->x_shift && k < pred_dim ? pred->x_shift[k] : 0.0);
+            }
+            flat.scale = values.size();
+            for (size_t k = 0; k < dim; k++) {
+                values.push_back(k >= pred_dim ? 0.0 : pred->x_shift ? pred->x_scale[k] : 1.0);
+            }
+        }
+
+        if (pred->nr_monomial > 0) {
+            flat.nr_monomial = pred->nr_monomial;
+            flat.weight = values.size();
+            for (int t = 0; t < pred->nr_monomial; t++) {
+                values.push_back(sign * pred->w[t]);
+            }
+            flat.monomial = indices.size();
+            indices.insert(indices.end(), pred->mono_parent, pred->mono_parent + pred->nr_monomial);
+            indices.insert(indices.end(), pred->mono_var, pred->mono_var + pred->nr_monomial);
+        } else {
+            flat.nr_sv = pred->l;
+            flat.sv = values.size();
+            for (int s = 0; s < pred->l; s++) {
+                for (size_t k = 0; k < dim; k++) {
+                    values.push_back(k < pred_dim ? pred->SV[s * pred_dim + k] : 0.0);
+                }
+            }
+            flat.coef = values.size();
+            for (int s = 0; s < pred->l; s++) {
+                values.push_back(sign * pred->coef[pred->coef_start[0] + s]);
+            }
+        }
+
+        partition.flat_nodes.push_back(flat);
+    }
+
+    view_flat(partition);
+}
+
+PSP_Partition compile_kdsvm(PSP_KdSVMTree tree)
+{
+    std::unique_ptr<PSP_PartitionRec_> result(new PSP_PartitionRec_);
+
+    std::deque<PSP_KdSVMTree> queue;
+    if (tree) {
+        queue.push_back(tree);
+    }
+
+    // the children of the i-th node are enqueued after those of the nodes
+    // before it, which gives their breadth-first indices
+    size_t next = 1;
+    while (!queue.empty()) {
+        PSP_KdSVMTree curr = queue.front();
+        queue.pop_front();
+
+        PSP_Partition_Node node = {};
+        if (curr->node.left && curr->node.right) {
+            node.predictor = make_predictor(curr->data.model);
+            node.left = next++;
+            node.right = next++;
+            queue.push_back((PSP_KdSVMTree)curr->node.left);
+            queue.push_back((PSP_KdSVMTree)curr->node.right);
+            result->dim = std::max(result->dim, (size_t)node.predictor->dim);
+        } else {
+            node.pattern = curr->data.pattern;
+        }
+        result->nodes.push_back(node);
+    }
+
+    flatten_kdsvm(*result);
+
+    return result.release();
+}
+
+PSP_Partition compile_mcsvm(PSP_MCSVM mcsvm)
+{
+    std::unique_ptr<PSP_PartitionRec_> result(new PSP_PartitionRec_);
+
+    PSP_Partition_Node node = {};
+    node.predictor = make_predictor(mcsvm->model);
+    result->nodes.push_back(node);
+    result->dim = node.predictor->dim;
+    result->multiclass = true;
+
+    return result.release();
+}
+
+/**
+ * Sorts the samples in [begin, end) of `order` into the implicit k-d tree,
+ * splitting each range at its median along the dimension of largest spread.
+ */
+static void build_knn_range(PSP_KNN_Tree& tree,
+                            std::vector<double> const& points,
+                            std::vector<size_t>& order,
+                            size_t begin,
+                            size_t end)
+{
+    if (end - begin <= KNN_LEAF_SIZE)
+        return;
+
+    size_t dim = tree.dim;
+    size_t axis = 0;
+    double spread = -1;
+    for (size_t i = 0; i < dim; i++) {
+        double lo = HUGE_VAL, hi = -HUGE_VAL;
+        for (size_t r = begin; r < end; r++) {
+            double v = points[order[r] * dim + i];
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        }
+        if ((hi - lo) * tree.scale[i] > spread) {
+            spread = (hi - lo) * tree.scale[i];
+            axis = i;
+        }
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](size_t a, size_t b) {
+        return points[a * dim + axis] < points[b * dim + axis];
+    });
+    tree.split_dim[mid] = (unsigned char)axis;
+
+    build_knn_range(tree, points, order, begin, mid);
+    build_knn_range(tree, points, order, mid + 1, end);
+}
+
+PSP_Partition build_knn(PSP_Result const& regions,
+                        size_t k,
+                        size_t max_per_region)
+{
+    size_t dim = nDim(regions);
+
+    if (k == 0 || k > KNN_MAX_K)
+        throw std::invalid_argument("the number of neighbours must be between 1 and 64");
+    if (dim > UCHAR_MAX)
+        throw std::invalid_argument("too many dimensions for a nearest-neighbour partition");
+
+    std::shared_ptr<PSP_KNN_Tree> tree = std::make_shared<PSP_KNN_Tree>();
+    tree->dim = dim;
+    tree->k = k;
+
+    // distances as if the search bounds were mapped to [-1, 1]
+    tree->scale.assign(dim, 1.0);
+    if ((size_t)regions.xMin.size() == dim && (size_t)regions.xMax.size() == dim) {
+        for (size_t i = 0; i < dim; i++) {
+            double range = regions.xMax[i] - regions.xMin[i];
+            tree->scale[i] = range > 0 ? 2 / range : 1;
+        }
+    }
+
+    // evenly spaced samples of the regions above the cap
+    std::vector<double> points;
+    std::vector<size_t> patterns;
+    for (size_t j = 0; j < regions.patterns.size(); j++) {
+        Sample_Store const& xs = regions.xs[j];
+        size_t count = max_per_region > 0 ? std::min(xs.size(), max_per_region) : xs.size();
+        for (size_t r = 0; r < count; r++) {
+            Point x = xs[r * xs.size() / count];
+            points.insert(points.end(), x.data(), x.data() + dim);
+            patterns.push_back(regions.patterns[j]);
+        }
+    }
+    if (patterns.empty())
+        throw std::invalid_argument("no samples to build a nearest-neighbour partition from");
+
+    size_t n = patterns.size();
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    tree->split_dim.assign(n, 0);
+    build_knn_range(*tree, points, order, 0, n);
+
+    tree->points.resize(n * dim);
+    tree->patterns.resize(n);
+    for (size_t r = 0; r < n; r++) {
+        std::copy(points.begin() + order[r] * dim, points.begin() + (order[r] + 1) * dim,
+                  tree->points.begin() + r * dim);
+        tree->patterns[r] = patterns[order[r]];
+    }
+
+    DEBUG_LOG("KNN: " << n << " samples, k = " << k << '\n');
+
+    std::unique_ptr<PSP_PartitionRec_> result(new PSP_PartitionRec_);
+    result->dim = dim;
+    result->knn = tree;
+    return result.release();
+}
+
+/** The `k` nearest samples found so far, by increasing distance. */
+struct KNN_Neighbours {
+    size_t size;
+    double dist[KNN_MAX_K];
+    size_t pattern[KNN_MAX_K];
+};
+
+static inline
+void add_neighbour(KNN_Neighbours& nn,
+                   size_t k,
+                   double dist,
+                   size_t pattern)
+{
+    if (nn.size == k && dist >= nn.dist[k - 1])
+        return;
+
+    size_t r = nn.size < k ? nn.size++ : k - 1;
+    for (; r > 0 && nn.dist[r - 1] > dist; r--) {
+        nn.dist[r] = nn.dist[r - 1];
+        nn.pattern[r] = nn.pattern[r - 1];
+    }
+    nn.dist[r] = dist;
+    nn.pattern[r] = pattern;
+}
+
+static void search_knn(PSP_KNN_Tree const& tree,
+                       double const* x,
+                       size_t begin,
+                       size_t end,
+                       KNN_Neighbours& nn)
+{
+    size_t dim = tree.dim;
+
+    auto visit = [&](size_t r) {
+        double const* p = tree.points.data() + r * dim;
+        double dist = 0;
+        for (size_t i = 0; i < dim; i++) {
+            double d = (x[i] - p[i]) * tree.scale[i];
+            dist += d * d;
+        }
+        add_neighbour(nn, tree.k, dist, tree.patterns[r]);
+    };
+
+    if (end - begin <= KNN_LEAF_SIZE) {
+        for (size_t r = begin; r < end; r++) {
+            visit(r);
+        }
+        return;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    size_t axis = tree.split_dim[mid];
+    double diff = (x[axis] - tree.points[mid * dim + axis]) * tree.scale[axis];
+
+    visit(mid);
+    if (diff < 0) {
+        search_knn(tree, x, begin, mid, nn);
+        if (nn.size < tree.k || diff * diff < nn.dist[nn.size - 1])
+            search_knn(tree, x, mid + 1, end, nn);
+    } else {
+        search_knn(tree, x, mid + 1, end, nn);
+        if (nn.size < tree.k || diff * diff < nn.dist[nn.size - 1])
+            search_knn(tree, x, begin, mid, nn);
+    }
+}
+
+/**
+ * Majority vote of the `k` nearest samples of x, ties going to the pattern
+ * with the nearest sample. The fraction of neighbours of the winning pattern
+ * is written to `share` if not NULL.
+ */
+static inline
+size_t predict_knn(PSP_KNN_Tree const& tree,
+                   double const* x,
+                   double* share = NULL)
+{
+    KNN_Neighbours nn;
+    nn.size = 0;
+    search_knn(tree, x, 0, tree.patterns.size(), nn);
+
+    size_t pattern[KNN_MAX_K], count[KNN_MAX_K];
+    size_t num_patterns = 0, best = 0;
+    for (size_t r = 0; r < nn.size; r++) {
+        size_t q = 0;
+        while (q < num_patterns && pattern[q] != nn.pattern[r]) {
+            q++;
+        }
+        if (q == num_patterns) {
+            pattern[q] = nn.pattern[r];
+            count[q] = 0;
+            num_patterns++;
+        }
+        count[q]++;
+        if (count[q] > count[best])
+            best = q;
+    }
+
+    if (share)
+        *share = (double)count[best] / nn.size;
+    return pattern[best];
+}
+
+PSP_Partition copy_partition(PSP_Partition partition)
+{
+    std::unique_ptr<PSP_PartitionRec_> result(new PSP_PartitionRec_);
+    result->dim = partition->dim;
+    result->multiclass = partition->multiclass;
+    result->knn = partition->knn;
+    result->mapping = partition->mapping;
+    result->executor = partition->executor;
+
+    // a mapped partition shares the arrays of the file
+    for (auto const& node : partition->nodes) {
+        result->nodes.push_back(node);
+        result->nodes.back().predictor = NULL;
+        if (node.predictor) {
+            result->nodes.back().predictor = node.predictor->shared
+                ? svm_predictor_share(node.predictor)
+                : svm_predictor_copy(node.predictor);
+            if (!result->nodes.back().predictor)
+                throw std::bad_alloc();
+        }
+    }
+
+    if (partition->mapping) {
+        result->flat = partition->flat;
+    } else {
+        result->flat_nodes = partition->flat_nodes;
+        result->flat_values = partition->flat_values;
+        result->flat_indices = partition->flat_indices;
+        view_flat(*result);
+    }
+
+    return result.release();
+}
+
+PSP_Flat_KdSVMRec flat_kdsvm(PSP_Partition partition)
+{
+    return partition->flat;
+}
+
+size_t predict_partition(PSP_Partition partition,
+                         const svm_node* x)
+{
+    if (partition->knn) {
+        size_t dim = partition->dim;
+        if ((size_t)x->dim >= dim)
+            return predict_knn(*partition->knn, x->values);
+
+        // missing coordinates are zero
+        std::vector<double> values(x->values, x->values + x->dim);
+        values.resize(dim, 0.0);
+        return predict_knn(*partition->knn, values.data());
+    }
+
+    if (partition->multiclass) {
+        return (size_t)svm_predictor_predict(partition->nodes[0].predictor, x, NULL);
+    }
+
+    size_t i = 0;
+    while (partition->nodes[i].predictor) {
+        PSP_Partition_Node const& node = partition->nodes[i];
+        i = svm_predictor_predict(node.predictor, x, NULL) > 0 ? node.left : node.right;
+    }
+
+    return partition->nodes[i].pattern;
+}
+
+/**
+ * Same as `predict_partition`, also giving how clearly the point is inside its
+ * region: the smallest absolute decision value along the path of a KdSVM, the
+ * smallest decision value of the winning class against the others for an
+ * MCSVM, and the fraction of neighbours of the winning pattern for a
+ * nearest-neighbour partition.
+ */
+size_t predict_partition_margin(PSP_Partition partition,
+                                const svm_node* x,
+                                double* margin)
+{
+    if (partition->knn) {
+        size_t dim = partition->dim;
+        std::vector<double> values(x->values, x->values + std::min((size_t)x->dim, dim));
+        values.resize(dim, 0.0);
+        return predict_knn(*partition->knn, values.data(), margin);
+    }
+
+    if (partition->multiclass) {
+        svm_predictor* pred = partition->nodes[0].predictor;
+        std::vector<double> dec_values(pred->nr_dec);
+        double label = svm_predictor_predict(pred, x, dec_values.data());
+
+        // the smallest decision value of the winner against another class
+        int nr_class = pred->nr_class;
+        int winner = 0;
+        while (winner < nr_class - 1 && pred->label[winner] != label) {
+            winner++;
+        }
+        *margin = HUGE_VAL;
+        int p = 0;
+        for (int i = 0; i < nr_class; i++) {
+            for (int j = i + 1; j < nr_class; j++, p++) {
+                if (i == winner)
+                    *margin = std::min(*margin, dec_values[p]);
+                else if (j == winner)
+                    *margin = std::min(*margin, -dec_values[p]);
+            }
+        }
+        return (size_t)label;
+    }
+
+    *margin = HUGE_VAL;
+    size_t i = 0;
+    while (partition->nodes[i].predictor) {
+        PSP_Partition_Node const& node = partition->nodes[i];
+        double dec_value;
+        double label = svm_predictor_predict(node.predictor, x, &dec_value);
+        *margin = std::min(*margin, std::abs(dec_value));
+        i = label > 0 ? node.left : node.right;
+    }
+
+    return partition->nodes[i].pattern;
+}
+
+static inline
+double powi(double base, int times)
+{
+    double tmp = base, ret = 1.0;
+
+    for (int t = times; t > 0; t /= 2) {
+        if (t % 2 == 1)
+            ret *= tmp;
+        tmp = tmp * tmp;
+    }
+    return ret;
+}
+
+/**
+ * Evaluates a predictor at the rows of `ws.x`, which are standardized in
+ * place, into `ws.result`. The kernel values of all points and SVs are
+ * computed at once from a matrix product, and so are the decision values.
+ */
+static inline
+void predict_block(svm_predictor const* pred,
+                   Batch_Workspace& ws)
+{
+    Matrix_RowMajor& x = ws.x;
+    Eigen::MatrixXd& kvalue = ws.kvalue;
+    svm_parameter const& param = pred->param;
+    Eigen::Index m = x.rows();
+
+    if (pred->x_shift) {
+        for (int k = 0; k < pred->dim; k++) {
+            x.col(k) = (x.col(k).array() - pred->x_shift[k]) * pred->x_scale[k];
+        }
+    }
+
+    int nr_class = pred->nr_class;
+    Eigen::MatrixXd& dec = ws.dec;
+
+    if (pred->nr_monomial > 0) {
+        // primal form: the monomials of the points, times the weights
+        int M = pred->nr_monomial;
+        Eigen::MatrixXd& monomial = ws.kvalue;
+        monomial.resize(m, M);
+        monomial.col(0).setOnes();
+        for (int t = 1; t < M; t++) {
+            monomial.col(t) = monomial.col(pred->mono_parent[t]).cwiseProduct(x.col(pred->mono_var[t]));
+        }
+
+        Eigen::Map<const Matrix_RowMajor> w(pred->w, pred->nr_dec, M);
+        dec.noalias() = monomial * w.transpose();
+        for (int p = 0; p < pred->nr_dec; p++) {
+            dec.col(p).array() -= pred->rho[p];
+        }
+    } else {
+        Eigen::Map<const Matrix_RowMajor> sv(pred->SV, pred->l, pred->dim);
+        kvalue.noalias() = x * sv.transpose();
+
+        switch (param.kernel_type) {
+        case POLY:
+            kvalue = kvalue.unaryExpr([&](double v) {
+                return powi(param.gamma * v + param.coef0, param.degree);
+            });
+            break;
+        case RBF: {
+            Eigen::VectorXd x_square = x.rowwise().squaredNorm();
+            Eigen::VectorXd sv_square = sv.rowwise().squaredNorm();
+            for (Eigen::Index j = 0; j < kvalue.cols(); j++) {
+                for (Eigen::Index i = 0; i < m; i++) {
+                    double dist = std::max(x_square[i] + sv_square[j] - 2 * kvalue(i, j), 0.0);
+                    kvalue(i, j) = std::exp(-param.gamma * dist);
+                }
+            }
+            break;
+        }
+        case SIGMOID:
+            kvalue = kvalue.unaryExpr([&](double v) {
+                return std::tanh(param.gamma * v + param.coef0);
+            });
+            break;
+        default:
+            break;
+        }
+
+        dec.resize(m, pred->nr_dec);
+
+        int p = 0;
+        for (int i = 0; i < nr_class && p < pred->nr_dec; i++) {
+            for (int j = i + 1; j < nr_class && p < pred->nr_dec; j++) {
+                int ci = pred->nSV[i];
+                int cj = pred->label ? pred->nSV[j] : 0;
+                Eigen::Map<const Eigen::VectorXd> coef_i(pred->coef + pred->coef_start[p], ci);
+                Eigen::Map<const Eigen::VectorXd> coef_j(pred->coef + pred->coef_start[p] + ci, cj);
+
+                dec.col(p).noalias() = kvalue.middleCols(pred->start[i], ci) * coef_i;
+                dec.col(p).noalias() += kvalue.middleCols(pred->start[j], cj) * coef_j;
+                dec.col(p).array() -= pred->rho[p];
+                p++;
+            }
+        }
+    }
+
+    ws.result.resize(m);
+
+    if (!pred->label) {
+        // regression or one-class
+        for (Eigen::Index i = 0; i < m; i++) {
+            double value = dec(i, 0);
+            ws.result[i] = param.svm_type == ONE_CLASS ? (value > 0 ? 1 : -1) : value;
+        }
+        return;
+    }
+
+    std::vector<int> vote(nr_class);
+    for (Eigen::Index r = 0; r < m; r++) {
+        std::fill(vote.begin(), vote.end(), 0);
+
+        int p = 0;
+        for (int i = 0; i < nr_class; i++) {
+            for (int j = i + 1; j < nr_class; j++) {
+                ++vote[dec(r, p) > 0 ? i : j];
+                p++;
+            }
+        }
+
+        ws.result[r] = pred->label[std::max_element(vote.begin(), vote.end()) - vote.begin()];
+    }
+}
+
+/**
+ * Evaluates the decision value of an inner node of the flat layout at the
+ * `m` points of `x`, given coordinate by coordinate. The loops run over the
+ * points, so that the compiler can vectorize them.
+ */
+static void evaluate_flat(PSP_Flat_NodeRec const& node,
+                          PSP_PartitionRec_ const& partition,
+                          double const* x,
+                          size_t m,
+                          Flat_Workspace& ws,
+                          double* dec)
+{
+    size_t dim = partition.dim;
+    double const* values = partition.flat.values;
+
+    for (size_t r = 0; r < m; r++) {
+        dec[r] = -node.rho;
+    }
+
+    if (node.nr_monomial > 0) {
+        size_t M = node.nr_monomial;
+        int const* parent = partition.flat.indices + node.monomial;
+        int const* var = parent + M;
+        double const* weight = values + node.weight;
+
+        ws.monomial.resize(M * m);
+        double* monomial = ws.monomial.data();
+        std::fill(monomial, monomial + m, 1.0);
+        for (size_t t = 1; t < M; t++) {
+            double const* base = monomial + parent[t] * m;
+            double const* xv = x + var[t] * m;
+            double* out = monomial + t * m;
+            for (size_t r = 0; r < m; r++) {
+                out[r] = base[r] * xv[r];
+            }
+        }
+        for (size_t t = 0; t < M; t++) {
+            double w = weight[t];
+            double const* in = monomial + t * m;
+            for (size_t r = 0; r < m; r++) {
+                dec[r] += w * in[r];
+            }
+        }
+        return;
+    }
+
+    ws.dot.resize(m);
+    double* dot = ws.dot.data();
+
+    if (node.kernel_type == RBF) {
+        ws.x_square.assign(m, 0.0);
+        for (size_t k = 0; k < dim; k++) {
+            double const* xk = x + k * m;
+            for (size_t r = 0; r < m; r++) {
+                ws.x_square[r] += xk[r] * xk[r];
+            }
+        }
+    }
+
+    double const* coef = values + node.coef;
+    for (int s = 0; s < node.nr_sv; s++) {
+        double const* sv = values + node.sv + s * dim;
+        std::fill(dot, dot + m, 0.0);
+        double sv_square = 0;
+        for (size_t k = 0; k < dim; k++) {
+            double v = sv[k];
+            double const* xk = x + k * m;
+            for (size_t r = 0; r < m; r++) {
+                dot[r] += v * xk[r];
+            }
+            sv_square += v * v;
+        }
+
+        double c = coef[s];
+        switch (node.kernel_type) {
+        case LINEAR:
+            for (size_t r = 0; r < m; r++) {
+                dec[r] += c * dot[r];
+            }
+            break;
+        case POLY:
+            for (size_t r = 0; r < m; r++) {
+                dec[r] += c * powi(node.gamma * dot[r] + node.coef0, node.degree);
+            }
+            break;
+        case RBF:
+            for (size_t r = 0; r < m; r++) {
+                double dist = std::max(ws.x_square[r] + sv_square - 2 * dot[r], 0.0);
+                dec[r] += c * std::exp(-node.gamma * dist);
+            }
+            break;
+        case SIGMOID:
+            for (size_t r = 0; r < m; r++) {
+                dec[r] += c * std::tanh(node.gamma * dot[r] + node.coef0);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * Routes the `m` points of `x`, given coordinate by coordinate, down the flat
+ * layout of a KdSVM partition one level at a time: the points reaching a node
+ * of the level are gathered and evaluated together.
+ */
+static void route_flat(PSP_PartitionRec_ const& partition,
+                       double const* x,
+                       size_t m,
+                       size_t* patterns,
+                       Flat_Workspace& ws)
+{
+    size_t dim = partition.dim;
+    double const* values = partition.flat.values;
+    PSP_Flat_NodeRec const* nodes = partition.flat.nodes;
+
+    if (nodes[0].left < 0) {
+        std::fill(patterns, patterns + m, nodes[0].pattern);
+        return;
+    }
+
+    ws.node.assign(m, 0);
+    ws.active.resize(m);
+    std::iota(ws.active.begin(), ws.active.end(), 0);
+    ws.dec.resize(m);
+
+    while (!ws.active.empty()) {
+        std::sort(ws.active.begin(), ws.active.end(), [&](size_t a, size_t b) {
+            return ws.node[a] < ws.node[b] || (ws.node[a] == ws.node[b] && a < b);
+        });
+        ws.next.clear();
+
+        for (size_t begin = 0; begin < ws.active.size(); ) {
+            int n = ws.node[ws.active[begin]];
+            size_t end = begin + 1;
+            while (end < ws.active.size() && ws.node[ws.active[end]] == n) {
+                end++;
+            }
+
+            PSP_Flat_NodeRec const& node = nodes[n];
+            size_t g = end - begin;
+            ws.x.resize(dim * g);
+            for (size_t k = 0; k < dim; k++) {
+                double shift = node.scaled ? values[node.shift + k] : 0.0;
+                double scale = node.scaled ? values[node.scale + k] : 1.0;
+                for (size_t r = 0; r < g; r++) {
+                    ws.x[k * g + r] = (x[k * m + ws.active[begin + r]] - shift) * scale;
+                }
+            }
+            evaluate_flat(node, partition, ws.x.data(), g, ws, ws.dec.data());
+
+            for (size_t r = 0; r < g; r++) {
+                size_t i = ws.active[begin + r];
+                int child = ws.dec[r] > 0 ? node.left : node.right;
+                if (nodes[child].left < 0) {
+                    patterns[i] = nodes[child].pattern;
+                } else {
+                    ws.node[i] = child;
+                    ws.next.push_back(i);
+                }
+            }
+
+            begin = end;
+        }
+
+        ws.active.swap(ws.next);
+    }
+}
+
+void predict_batch(PSP_Partition partition,
+                   size_t num_points,
+                   Fixed const* points,
+                   size_t* patterns,
+                   size_t num_threads)
+{
+    size_t dim = partition->dim;
+    size_t num_blocks = (num_points + BATCH_BLOCK - 1) / BATCH_BLOCK;
+
+    parallel_for(num_blocks, [&](size_t b) {
+        size_t begin = b * BATCH_BLOCK;
+        size_t m = std::min(BATCH_BLOCK, num_points - begin);
+
+        if (partition->knn) {
+            std::vector<double> x(dim);
+            for (size_t i = 0; i < m; i++) {
+                for (size_t k = 0; k < dim; k++) {
+                    x[k] = map_coord(points[(begin + i) * dim + k]);
+                }
+                patterns[begin + i] = predict_knn(*partition->knn, x.data());
+            }
+            return;
+        }
+
+        if (!partition->multiclass) {
+            Flat_Workspace ws;
+            std::vector<double> x(dim * m);
+            for (size_t i = 0; i < m; i++) {
+                for (size_t k = 0; k < dim; k++) {
+                    x[k * m + i] = map_coord(points[(begin + i) * dim + k]);
+                }
+            }
+            route_flat(*partition, x.data(), m, patterns + begin, ws);
+            return;
+        }
+
+        Batch_Workspace ws;
+        Matrix_RowMajor x = Eigen::Map<const Eigen::Matrix<Fixed, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>(
+            points + begin * dim, m, dim).unaryExpr([](Fixed c) { return map_coord(c); });
+
+        ws.x = std::move(x);
+        predict_block(partition->nodes[0].predictor, ws);
+        for (size_t i = 0; i < m; i++) {
+            patterns[begin + i] = (size_t)ws.result[i];
+        }
+    }, num_threads);
+}
+
+/* EOF */
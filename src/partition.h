@@ -0,0 +1,150 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stddef.h>
+#include "svm.h"
+
+#ifdef __cplusplus
+#include <memory>
+#include <vector>
+#include "buildpart_kdsvm.h"
+#include "buildpart_mcsvm.h"
+#include "parallel.h"
+
+
+extern "C"
+{
+#endif
+
+typedef struct PSP_PartitionRec_ *PSP_Partition;
+
+/**
+ * A node of the flat layout of a KdSVM partition. The arrays of a node are
+ * stored next to each other in the `values` and `indices` of the layout and
+ * are given by offsets into them.
+ *
+ * A point x goes to the left child iff sum_k coef[k] K(x', sv_k) - rho > 0,
+ * or sum_t weight[t] monomial_t(x') - rho > 0 when `nr_monomial` > 0, where
+ * x' = (x - shift) * scale if the node is scaled and x otherwise.
+ */
+typedef struct PSP_Flat_NodeRec_ {
+    int left;           /* breadth-first index of the children, -1 for leaves */
+    int right;
+    size_t pattern;     /* leaves: data pattern of the region */
+
+    int kernel_type;
+    int degree;
+    double gamma;
+    double coef0;
+    double rho;
+
+    int nr_sv;
+    int nr_monomial;    /* 0 unless evaluated in primal form */
+    int scaled;
+    size_t sv;          /* nr_sv * dim values, SV by SV */
+    size_t coef;        /* nr_sv values */
+    size_t shift;       /* dim values, if scaled */
+    size_t scale;       /* dim values, if scaled */
+    size_t weight;      /* nr_monomial values */
+    size_t monomial;    /* nr_monomial indices of the parent monomials, then */
+                        /* nr_monomial indices of the variables, as in */
+                        /* `svm_predictor` */
+} PSP_Flat_NodeRec;
+
+/** Breadth-first layout of a KdSVM partition, the root first. */
+typedef struct PSP_Flat_KdSVMRec_ {
+    size_t dim;
+    size_t num_nodes;
+    const PSP_Flat_NodeRec* nodes;
+    size_t num_values;
+    const double* values;
+    size_t num_indices;
+    const int* indices;
+} PSP_Flat_KdSVMRec;
+
+#ifdef __cplusplus
+}
+
+
+struct PSP_Partition_Node {
+    // inner nodes: the point belongs to the left subtree iff predicting > 0
+    svm_predictor* predictor;
+    size_t left;
+    size_t right;
+    // leaves: the data pattern of the region
+    size_t pattern;
+};
+
+/**
+ * A static k-d tree over labelled samples, in implicit form: the node of a
+ * range [begin, end) of the samples is its middle sample, splitting along
+ * `split_dim[middle]`, and ranges of at most `KNN_LEAF_SIZE` samples are
+ * leaves searched linearly. Distances are measured after scaling the
+ * coordinates by `scale`.
+ */
+struct PSP_KNN_Tree {
+    size_t dim;
+    size_t k;
+    std::vector<double> scale;
+    std::vector<double> points;     // sample by sample
+    std::vector<size_t> patterns;
+    std::vector<unsigned char> split_dim;
+};
+
+/**
+ * A KdSVM tree or MCSVM node compiled for prediction, independent of the
+ * handle that built it. The nodes of a KdSVM tree are stored breadth-first,
+ * the root first; an MCSVM is a single node whose predictor returns the
+ * pattern.
+ *
+ * A KdSVM tree is also stored in the flat layout, which batch prediction
+ * traverses level by level. `flat` points into the `flat_*` vectors, or into
+ * `mapping` for a partition loaded from a file, whose predictors use the
+ * arrays of the file too.
+ *
+ * A nearest-neighbour partition has no nodes, its tree being shared by the
+ * copies of the partition.
+ */
+struct PSP_PartitionRec_ {
+    size_t dim;
+    bool multiclass;
+    std::vector<PSP_Partition_Node> nodes;
+
+    std::vector<PSP_Flat_NodeRec> flat_nodes;
+    std::vector<double> flat_values;
+    std::vector<int> flat_indices;
+    PSP_Flat_KdSVMRec flat;
+
+    std::shared_ptr<const void> mapping;
+    std::shared_ptr<const PSP_KNN_Tree> knn;
+
+    // runs the parallel stages of batch predictions, the pool if not set
+    PSP_ExecutorRec executor = {};
+
+    PSP_PartitionRec_() : dim(0), multiclass(false), flat() { }
+    PSP_PartitionRec_(PSP_PartitionRec_ const& other) = delete;
+    PSP_PartitionRec_ & operator=(PSP_PartitionRec_ const& other) = delete;
+    ~PSP_PartitionRec_();
+};
+
+PSP_Partition compile_kdsvm(PSP_KdSVMTree tree);
+PSP_Partition compile_mcsvm(PSP_MCSVM node);
+PSP_Partition build_knn(PSP_Result const& regions,
+                        size_t k,
+                        size_t max_per_region);
+PSP_Partition copy_partition(PSP_Partition partition);
+PSP_Flat_KdSVMRec flat_kdsvm(PSP_Partition partition);
+size_t predict_partition(PSP_Partition partition, const svm_node* x);
+size_t predict_partition_margin(PSP_Partition partition,
+                                const svm_node* x,
+                                double* margin);
+void predict_batch(PSP_Partition partition,
+                   size_t num_points,
+                   Fixed const* points,
+                   size_t* patterns,
+                   size_t num_threads);
+#endif
+
+#endif
+
+/* EOF */
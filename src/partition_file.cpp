@@ -0,0 +1,429 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "debug.h"
+#include "mapped_file.h"
+#include "partition_file.h"
+
+/*
+ * A partition file is a header followed by the table of the tree nodes, the
+ * table of the predictors and the arrays of the predictors and of the flat
+ * layout. Every table and array starts at a multiple of `FILE_ALIGN` bytes,
+ * and the arrays are stored as in memory, so that a mapped file is used in
+ * place. Offsets are from the start of the file. The byte order and sizes of
+ * the platform that wrote the file are recorded, and files of another
+ * platform are rejected rather than converted.
+ */
+
+static const char FILE_MAGIC[8] = { 'P', 'S', 'P', 'P', 'A', 'R', 'T', '\0' };
+static const uint32_t FILE_VERSION = 1;
+static const uint32_t FILE_BYTE_ORDER = 0x01020304;
+// alignment of the tables and arrays, that of the predictor arrays in memory
+static const size_t FILE_ALIGN = 64;
+// predictor index of leaves
+static const uint64_t FILE_NO_PREDICTOR = UINT64_MAX;
+
+static_assert(sizeof(int) == 4, "partition files store int arrays as 32-bit integers");
+
+struct Partition_File_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t word_size;         // sizeof(size_t)
+    uint32_t flat_node_size;    // sizeof(PSP_Flat_NodeRec)
+    uint64_t size;              // of the whole file
+
+    uint64_t dim;
+    uint32_t multiclass;
+    uint32_t reserved;
+    uint64_t num_nodes;
+    uint64_t nodes;             // Partition_File_Node[num_nodes]
+    uint64_t num_predictors;
+    uint64_t predictors;        // Partition_File_Predictor[num_predictors]
+
+    uint64_t num_flat_nodes;
+    uint64_t flat_nodes;        // PSP_Flat_NodeRec[num_flat_nodes]
+    uint64_t num_flat_values;
+    uint64_t flat_values;
+    uint64_t num_flat_indices;
+    uint64_t flat_indices;
+};
+
+struct Partition_File_Node {
+    uint64_t left;
+    uint64_t right;
+    uint64_t pattern;
+    uint64_t predictor;         // index in the predictor table
+};
+
+/** The shape and parameters of an `svm_predictor`, and offsets of its arrays */
+struct Partition_File_Predictor {
+    int32_t svm_type;
+    int32_t kernel_type;
+    int32_t degree;
+    int32_t fast;
+    double gamma;
+    double coef0;
+
+    int32_t nr_class;
+    int32_t l;
+    int32_t dim;
+    int32_t nr_dec;
+    int32_t nr_coef;
+    int32_t nr_monomial;
+
+    // 0 for arrays the predictor does not have
+    uint64_t SV;
+    uint64_t start;
+    uint64_t nSV;
+    uint64_t coef;
+    uint64_t coef_start;
+    uint64_t rho;
+    uint64_t label;
+    uint64_t x_shift;
+    uint64_t x_scale;
+    uint64_t mono_parent;
+    uint64_t mono_var;
+    uint64_t w;
+    uint64_t order;
+    uint64_t coef_bound;
+    uint64_t norm_min;
+    uint64_t norm_max;
+};
+
+/**
+ * Assigns aligned offsets to the blocks of a file, which are written in that
+ * order once all of them are known.
+ */
+struct File_Layout {
+    struct Block {
+        uint64_t offset;
+        void const* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    uint64_t size = 0;
+
+    uint64_t add(void const* data, size_t size)
+    {
+        uint64_t offset = (this->size + FILE_ALIGN - 1) / FILE_ALIGN * FILE_ALIGN;
+        blocks.push_back({offset, data, size});
+        this->size = offset + size;
+        return offset;
+    }
+
+    template <typename T>
+    uint64_t add_array(T const* data, size_t count)
+    {
+        return data ? add(data, count * sizeof(T)) : 0;
+    }
+};
+
+/** Fills the table entry of a predictor and adds its arrays to the layout */
+static void layout_predictor(svm_predictor const* pred,
+                             Partition_File_Predictor& entry,
+                             File_Layout& layout)
+{
+    entry.svm_type = pred->param.svm_type;
+    entry.kernel_type = pred->param.kernel_type;
+    entry.degree = pred->param.degree;
+    entry.fast = pred->fast;
+    entry.gamma = pred->param.gamma;
+    entry.coef0 = pred->param.coef0;
+
+    entry.nr_class = pred->nr_class;
+    entry.l = pred->l;
+    entry.dim = pred->dim;
+    entry.nr_dec = pred->nr_dec;
+    entry.nr_coef = pred->nr_coef;
+    entry.nr_monomial = pred->nr_monomial;
+
+    size_t M = pred->nr_monomial;
+    size_t l = pred->l;
+    entry.SV = layout.add_array(pred->SV, l * pred->dim);
+    entry.start = layout.add_array(pred->start, pred->nr_class);
+    entry.nSV = layout.add_array(pred->nSV, pred->nr_class);
+    entry.coef = layout.add_array(pred->coef, pred->nr_coef);
+    entry.coef_start = layout.add_array(pred->coef_start, pred->nr_dec);
+    entry.rho = layout.add_array(pred->rho, pred->nr_dec);
+    entry.label = layout.add_array(pred->label, pred->nr_class);
+    entry.x_shift = layout.add_array(pred->x_shift, pred->dim);
+    entry.x_scale = layout.add_array(pred->x_scale, pred->dim);
+    if (M > 0) {
+        entry.mono_parent = layout.add_array(pred->mono_parent, M);
+        entry.mono_var = layout.add_array(pred->mono_var, M);
+        entry.w = layout.add_array(pred->w, M * pred->nr_dec);
+    }
+    entry.order = layout.add_array(pred->order, l);
+    entry.coef_bound = layout.add_array(pred->coef_bound, l + 1);
+    entry.norm_min = layout.add_array(pred->norm_min, l + 1);
+    entry.norm_max = layout.add_array(pred->norm_max, l + 1);
+}
+
+void save_partition(PSP_Partition partition,
+                    const char* path)
+{
+    if (partition->knn)
+        throw std::invalid_argument("nearest-neighbour partitions cannot be saved");
+
+    File_Layout layout;
+    Partition_File_Header header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.byte_order = FILE_BYTE_ORDER;
+    header.word_size = sizeof(size_t);
+    header.flat_node_size = sizeof(PSP_Flat_NodeRec);
+    header.dim = partition->dim;
+    header.multiclass = partition->multiclass;
+    layout.add(&header, sizeof(header));
+
+    size_t num_predictors = 0;
+    for (auto const& node : partition->nodes) {
+        num_predictors += node.predictor != NULL;
+    }
+    std::vector<Partition_File_Node> nodes(partition->nodes.size());
+    std::vector<Partition_File_Predictor> predictors(num_predictors);
+    header.num_nodes = nodes.size();
+    header.nodes = layout.add_array(nodes.data(), nodes.size());
+    header.num_predictors = predictors.size();
+    header.predictors = layout.add_array(predictors.data(), predictors.size());
+
+    size_t next = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        PSP_Partition_Node const& node = partition->nodes[i];
+        nodes[i].left = node.left;
+        nodes[i].right = node.right;
+        nodes[i].pattern = node.pattern;
+        nodes[i].predictor = FILE_NO_PREDICTOR;
+        if (node.predictor) {
+            nodes[i].predictor = next;
+            layout_predictor(node.predictor, predictors[next++], layout);
+        }
+    }
+
+    PSP_Flat_KdSVMRec const& flat = partition->flat;
+    header.num_flat_nodes = flat.num_nodes;
+    header.flat_nodes = layout.add_array(flat.nodes, flat.num_nodes);
+    header.num_flat_values = flat.num_values;
+    header.flat_values = layout.add_array(flat.values, flat.num_values);
+    header.num_flat_indices = flat.num_indices;
+    header.flat_indices = layout.add_array(flat.indices, flat.num_indices);
+    header.size = layout.size;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    static const char padding[FILE_ALIGN] = {};
+    uint64_t offset = 0;
+    for (auto const& block : layout.blocks) {
+        file.write(padding, block.offset - offset);
+        file.write(static_cast<char const*>(block.data), block.size);
+        offset = block.offset + block.size;
+    }
+    file.close();
+    if (!file)
+        throw std::system_error(errno ? errno : EIO, std::generic_category(), path);
+
+    DEBUG_LOG("Saved partition of " << nodes.size() << " nodes to " << path
+              << " (" << header.size << " bytes)\n");
+}
+
+static inline
+void check(bool condition)
+{
+    if (!condition)
+        throw std::invalid_argument("corrupt partition file");
+}
+
+/**
+ * Checks the monomials of a primal form: monomial t > 0 extends an earlier
+ * one by a variable below `dim`.
+ */
+static inline
+void check_monomials(int const* parent,
+                     int const* var,
+                     size_t M,
+                     int dim)
+{
+    for (size_t t = 1; t < M; t++) {
+        check(parent[t] >= 0 && (size_t)parent[t] < t && var[t] >= 0 && var[t] < dim);
+    }
+}
+
+/**
+ * Builds the predictor of a table entry, whose arrays are those of the file.
+ * Every index that prediction follows is checked to stay in its array.
+ */
+static svm_predictor* map_predictor(Mapped_File const& file,
+                                    Partition_File_Predictor const& entry)
+{
+    check(entry.kernel_type >= LINEAR && entry.kernel_type <= SIGMOID);
+    check(entry.svm_type >= C_SVC && entry.svm_type <= NU_SVR);
+    check(entry.nr_class >= 2 && entry.l >= 0 && entry.dim >= 0 &&
+          entry.nr_coef >= 0 && entry.nr_monomial >= 0);
+    bool classification = entry.svm_type == C_SVC || entry.svm_type == NU_SVC;
+    check(entry.nr_dec == (classification ? entry.nr_class * (entry.nr_class - 1) / 2 : 1));
+    check(classification || entry.nr_class == 2);
+
+    svm_predictor pred;
+    memset(&pred, 0, sizeof(pred));
+    pred.param.svm_type = entry.svm_type;
+    pred.param.kernel_type = entry.kernel_type;
+    pred.param.degree = entry.degree;
+    pred.param.gamma = entry.gamma;
+    pred.param.coef0 = entry.coef0;
+    pred.nr_class = entry.nr_class;
+    pred.l = entry.l;
+    pred.dim = entry.dim;
+    pred.nr_dec = entry.nr_dec;
+    pred.nr_coef = entry.nr_coef;
+    pred.nr_monomial = entry.nr_monomial;
+    pred.fast = entry.fast;
+
+    size_t l = entry.l;
+    size_t M = entry.nr_monomial;
+    pred.SV = const_cast<double*>(file.array<double>(entry.SV, l * entry.dim));
+    pred.start = const_cast<int*>(file.array<int>(entry.start, entry.nr_class));
+    pred.nSV = const_cast<int*>(file.array<int>(entry.nSV, entry.nr_class));
+    pred.coef = const_cast<double*>(file.array<double>(entry.coef, entry.nr_coef));
+    pred.coef_start = const_cast<int*>(file.array<int>(entry.coef_start, entry.nr_dec));
+    pred.rho = const_cast<double*>(file.array<double>(entry.rho, entry.nr_dec));
+    pred.label = const_cast<int*>(file.optional_array<int>(entry.label, entry.nr_class));
+    pred.x_shift = const_cast<double*>(file.optional_array<double>(entry.x_shift, entry.dim));
+    pred.x_scale = const_cast<double*>(file.optional_array<double>(entry.x_scale, entry.dim));
+    check(!pred.x_shift == !pred.x_scale && !pred.label == !classification);
+    if (M > 0) {
+        pred.mono_parent = const_cast<int*>(file.array<int>(entry.mono_parent, M));
+        pred.mono_var = const_cast<int*>(file.array<int>(entry.mono_var, M));
+        pred.w = const_cast<double*>(file.array<double>(entry.w, M * entry.nr_dec));
+        check_monomials(pred.mono_parent, pred.mono_var, M, entry.dim);
+    }
+    pred.order = const_cast<int*>(file.optional_array<int>(entry.order, l));
+    pred.coef_bound = const_cast<double*>(file.optional_array<double>(entry.coef_bound, l + 1));
+    pred.norm_min = const_cast<double*>(file.optional_array<double>(entry.norm_min, l + 1));
+    pred.norm_max = const_cast<double*>(file.optional_array<double>(entry.norm_max, l + 1));
+    check(!pred.order == !pred.coef_bound && !pred.order == !pred.norm_min &&
+          !pred.order == !pred.norm_max);
+
+    // the SVs and coefficients of each decision function
+    for (int i = 0; i < pred.nr_class; i++) {
+        check(pred.start[i] >= 0 && pred.nSV[i] >= 0 && pred.nSV[i] <= entry.l - pred.start[i]);
+    }
+    int p = 0;
+    for (int i = 0; i < pred.nr_class && p < pred.nr_dec; i++) {
+        for (int j = i + 1; j < pred.nr_class && p < pred.nr_dec; j++, p++) {
+            int64_t count = pred.nSV[i] + (pred.label ? (int64_t)pred.nSV[j] : 0);
+            check(pred.coef_start[p] >= 0 && pred.coef_start[p] + count <= entry.nr_coef);
+        }
+    }
+    if (pred.order) {
+        for (size_t k = 0; k < l; k++) {
+            check(pred.order[k] >= 0 && (size_t)pred.order[k] < l);
+        }
+    }
+
+    svm_predictor* result = svm_predictor_share(&pred);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+/** Checks that the flat layout only refers to its own nodes and arrays */
+static void check_flat(PSP_Flat_KdSVMRec const& flat)
+{
+    size_t dim = flat.dim;
+    for (size_t i = 0; i < flat.num_nodes; i++) {
+        PSP_Flat_NodeRec const& node = flat.nodes[i];
+        if (node.left < 0) {
+            check(node.right < 0);
+            continue;
+        }
+        check((size_t)node.left > i && (size_t)node.left < flat.num_nodes);
+        check((size_t)node.right > i && (size_t)node.right < flat.num_nodes);
+        check(node.kernel_type >= LINEAR && node.kernel_type <= SIGMOID);
+        check(node.nr_sv >= 0 && node.nr_monomial >= 0);
+
+        auto fits = [](size_t offset, size_t count, size_t size) {
+            return offset <= size && count <= size - offset;
+        };
+        if (node.scaled) {
+            check(fits(node.shift, dim, flat.num_values) && fits(node.scale, dim, flat.num_values));
+        }
+        if (node.nr_monomial > 0) {
+            size_t M = node.nr_monomial;
+            check(fits(node.weight, M, flat.num_values));
+            check(fits(node.monomial, 2 * M, flat.num_indices));
+            int const* parent = flat.indices + node.monomial;
+            check_monomials(parent, parent + M, M, (int)dim);
+        } else {
+            check(dim == 0 || (size_t)node.nr_sv <= flat.num_values / dim);
+            check(fits(node.sv, node.nr_sv * dim, flat.num_values));
+            check(fits(node.coef, node.nr_sv, flat.num_values));
+        }
+    }
+}
+
+PSP_Partition load_partition(const char* path)
+{
+    Mapped_File file = map_file(path, "partition file", sizeof(Partition_File_Header));
+    std::unique_ptr<PSP_PartitionRec_> result(new PSP_PartitionRec_);
+    result->mapping = file.mapping;
+
+    Partition_File_Header const& header = *file.array<Partition_File_Header>(0, 1);
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+        throw std::invalid_argument("not a partition file");
+    if (header.version != FILE_VERSION)
+        throw std::invalid_argument("unsupported partition file version");
+    if (header.byte_order != FILE_BYTE_ORDER || header.word_size != sizeof(size_t) ||
+        header.flat_node_size != sizeof(PSP_Flat_NodeRec))
+        throw std::invalid_argument("partition file written on another platform");
+    check(header.size == file.size);
+
+    result->dim = header.dim;
+    result->multiclass = header.multiclass != 0;
+
+    auto nodes = file.array<Partition_File_Node>(header.nodes, header.num_nodes);
+    auto predictors = file.array<Partition_File_Predictor>(header.predictors, header.num_predictors);
+    check(!result->multiclass || (header.num_nodes == 1 && nodes[0].predictor == 0));
+
+    result->nodes.reserve(header.num_nodes);
+    for (size_t i = 0; i < header.num_nodes; i++) {
+        PSP_Partition_Node node = {};
+        node.pattern = nodes[i].pattern;
+        if (nodes[i].predictor != FILE_NO_PREDICTOR) {
+            check(nodes[i].predictor < header.num_predictors);
+            // children come after their parent, so that walking the tree ends
+            if (!result->multiclass) {
+                check(nodes[i].left > i && nodes[i].left < header.num_nodes);
+                check(nodes[i].right > i && nodes[i].right < header.num_nodes);
+                node.left = nodes[i].left;
+                node.right = nodes[i].right;
+            }
+            node.predictor = map_predictor(file, predictors[nodes[i].predictor]);
+            check((size_t)node.predictor->dim <= result->dim || result->multiclass);
+        }
+        result->nodes.push_back(node);
+    }
+
+    PSP_Flat_KdSVMRec& flat = result->flat;
+    flat.dim = result->dim;
+    flat.num_nodes = header.num_flat_nodes;
+    flat.nodes = file.array<PSP_Flat_NodeRec>(header.flat_nodes, header.num_flat_nodes);
+    flat.num_values = header.num_flat_values;
+    flat.values = file.array<double>(header.flat_values, header.num_flat_values);
+    flat.num_indices = header.num_flat_indices;
+    flat.indices = file.array<int>(header.flat_indices, header.num_flat_indices);
+    check(result->multiclass ? flat.num_nodes == 0 : flat.num_nodes == header.num_nodes);
+    check_flat(flat);
+
+    DEBUG_LOG("Mapped partition of " << header.num_nodes << " nodes from " << path << "\n");
+
+    return result.release();
+}
+
+/* EOF */
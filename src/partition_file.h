@@ -0,0 +1,28 @@
+#ifndef PARTITION_FILE_H
+#define PARTITION_FILE_H
+
+#include "partition.h"
+
+#ifdef __cplusplus
+#include <system_error>
+
+/**
+ * Writes a compiled partition to a binary file, see `PSP_Save_Partition`.
+ * Throws std::invalid_argument for nearest-neighbour partitions and
+ * std::system_error if the file cannot be written.
+ */
+void save_partition(PSP_Partition partition, const char* path);
+
+/**
+ * Maps a file written by `save_partition` and returns a partition using its
+ * arrays in place. Throws std::invalid_argument if the file is not a valid
+ * partition file of this version and platform, and std::system_error if it
+ * cannot be mapped.
+ */
+PSP_Partition load_partition(const char* path);
+
+#endif
+
+#endif
+
+/* EOF */
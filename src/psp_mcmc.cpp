@@ -12,10 +12,18 @@
 
 #include "debug.h"
 #include "psp_mcmc.h"
+#include "sample_sink.h"
 #include <unsupported/Eigen/MatrixFunctions>
 
 using namespace Eigen;
 
+/** lgamma without the global sign it sets, so that searches can run concurrently */
+static inline
+double log_gamma(double x)
+{
+    int sign;
+    return lgamma_r(x, &sign);
+}
 
 struct MarkovChain {
     MarkovChain(int sampleCount = 0, double optJump = 0, int level = 0, int alp = 0)
@@ -62,7 +70,11 @@ private:
 };
 
 struct Regions {
-    std::vector<Points> xs;
+    std::shared_ptr<const Sample_Storage> storage;
+    std::vector<Sample_Store> xs;
+    // current point of the chain of each region, kept exactly as the stored
+    // samples may be quantized
+    std::vector<Point> current;
     std::vector<Pattern> patterns;
     std::vector<VectorXd> xsum;
     std::vector<MatrixXd> xcsum;
@@ -73,7 +85,11 @@ struct Regions {
 
     void push_back(Region new_region)
     {
-        xs.push_back(new_region.xs);
+        xs.emplace_back(new_region.xs.front().size(), storage);
+        for (auto const& x : new_region.xs) {
+            xs.back().push_back(x);
+        }
+        current.push_back(new_region.xs.back());
         patterns.push_back(new_region.pattern);
         xsum.push_back(new_region.xsum);
         xcsum.push_back(new_region.xcsum);
@@ -90,7 +106,9 @@ struct Regions {
 
     Region operator[](int i)
     {
-        return { xs[i], patterns[i], xsum[i], xcsum[i], { sampleCount[i], optJump[i], levels[i], alps[i] } };
+        Points points;
+        xs[i].for_each([&](Point const& x) { points.push_back(x); });
+        return { points, patterns[i], xsum[i], xcsum[i], { sampleCount[i], optJump[i], levels[i], alps[i] } };
     }
 };
 
@@ -108,7 +126,10 @@ size_t nDim(PSP_Result const& psp_result)
  * MATLAB code authored by Woojae Kim, Department of Psychology, Ohio State
  * University   $Revision: 3.0 $  $Date: 2005/07/19 $
  */
-PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options options)
+PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options options,
+                    Sample_Stream* stream, bool retain_samples,
+                    std::shared_ptr<const Sample_Storage> storage,
+                    Batch_Model batch_model)
 {
     std::default_random_engine generator(TIME_NOW);
     std::normal_distribution<double> randn;
@@ -142,6 +163,7 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     std::unordered_set<Pattern> foundPatterns;
 
     Regions regions;
+    regions.storage = bound_storage(storage, xMin, xMax);
     std::vector<std::pair<time_t, int>> searchTime;
 
     time_t t0 = TIME_NOW;
@@ -150,13 +172,31 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     DEBUG_LOG("=================================================================\n"
               "PSP SEARCH STARTS...\n\n");
 
+    auto evaluate = [&model, &batch_model](Eigen::Ref<const MatrixXd> ys, std::vector<Pattern>& ptns) {
+        ptns.resize(ys.cols());
+        if (ys.cols() == 0)
+            return;
+        if (batch_model) {
+            batch_model(ys, ptns.data());
+        } else {
+            for (int j = 0; j < ys.cols(); j++) {
+                ptns[j] = model(ys.col(j));
+            }
+        }
+    };
+
+    std::vector<Pattern> startPtns;
+    evaluate(x0, startPtns);
     for (int i = 0; i < x0.cols(); i++) {
         Point y = x0.col(i);
-        Pattern currPtn = model(y);
+        Pattern currPtn = startPtns[i];
 
         if (foundPatterns.insert(currPtn).second) {
             regions.push_back({ y, currPtn });
             searchTime.push_back({ TIME_NOW - t0, numTrials });
+            if (stream) {
+                stream->push(regions.size() - 1, currPtn, y);
+            }
 
             DEBUG_LOG("New data pattern found: " << currPtn <<
                       " at: " << y.transpose() << "\n");
@@ -188,21 +228,31 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
         VectorXd rnd1 = VectorXd::NullaryExpr(nDim, [&]() { return randn(generator); });
         VectorXd rnd2 = pow(rand(generator), 1 / nDim) * rnd1.normalized();
         VectorXd jump = xRange.cwiseProduct(iniJmp * pow(2, regions.optJump[regionIdx]) * rnd2);
-        Point y = regions.xs[regionIdx].back() + jump;
+        Point y = regions.current[regionIdx] + jump;
         numTrials++;
 
         if ((xMin.array() <= y.array()).all() && (y.array() <= xMax.array()).all()) {
             Pattern currPtn = model(y);
 
             if ((currPtn == regions.patterns[regionIdx])) {
+                if (!retain_samples) {
+                    regions.xs[regionIdx].clear();
+                }
                 regions.xs[regionIdx].push_back(y);
+                regions.current[regionIdx] = y;
                 regions.alps[regionIdx]++;
+                if (stream) {
+                    stream->push(regionIdx, currPtn, y);
+                }
             } else if (foundPatterns.size() > options.maxPatterns) {
                 /* exit if there are too many patterns */
                 throw PSP::too_many_patterns();
             } else if (foundPatterns.insert(currPtn).second) {
                 regions.push_back({ y, currPtn });
                 searchTime.push_back({ TIME_NOW - t0, numTrials });
+                if (stream) {
+                    stream->push(regions.size() - 1, currPtn, y);
+                }
 
                 iterCount1 = iterCount2 = 0;
                 cnt1 = cnt2 = TIME_NOW;
@@ -299,7 +349,7 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
                           << "Cycle #" << tmp << ", Acceptance rate (cumulative): " << acrate << '\n');
             }
 
-            Point lastPoint = regions.xs[regionIdx].back();
+            Point const& lastPoint = regions.current[regionIdx];
             regions.xsum[regionIdx] += lastPoint;
             regions.xcsum[regionIdx] += lastPoint * lastPoint.transpose();
         } break;
@@ -323,7 +373,7 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     }
 
     std::vector<Pattern> resultPatterns(regions.patterns);
-    std::vector<Points> resultXs(regions.xs);
+    std::vector<Sample_Store> resultXs(regions.xs);
     std::vector<VectorXd> resultXMean;
     std::vector<MatrixXd> resultXCovMat;
     resultXMean.reserve(regions.size());
@@ -341,8 +391,8 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     double nHalf = nDim * 0.5;
     double nFloor = floor(nHalf);
     double offset = nHalf == nFloor
-                    ? nHalf * log(PI) - lgamma(nHalf + 1)
-                    : nDim * log(2) + lgamma(nFloor + 1) - lgamma(nDim + 1) + nFloor * log(PI);
+                    ? nHalf * log(PI) - log_gamma(nHalf + 1)
+                    : nDim * log(2) + log_gamma(nFloor + 1) - log_gamma(nDim + 1) + nFloor * log(PI);
     for (int i = 0; i < regions.size(); i++) {
         logvol[i] = offset + .5 * (log(nDim + 2)
             + resultXCovMat[i].eigenvalues().array().log())
@@ -357,17 +407,25 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
 
             DEBUG_LOG("Estimating the volume of Region #" << i << std::endl);
 
+            // the points within the bounds are evaluated at once
             MatrixXd sqrtm = ((nDim + 2) * resultXCovMat[i]).sqrt();
+            MatrixXd ys(nDim, vsmpsz);
+            int numInside = 0;
             for (int j = 0; j < vsmpsz; j++) {
                 VectorXd rnd1 = VectorXd::NullaryExpr(nDim, [&]() { return randn(generator); });
                 VectorXd rnd2 = pow(rand(generator), 1 / nDim) * rnd1.normalized();
                 Point y = resultXMean[i] + sqrtm * rnd2;
 
                 if ((xMin.array() <= y.array()).all() && (y.array() <= xMax.array()).all()) {
-                    Pattern cPtn = model(y);
-                    if (cPtn == regions.patterns[i]) {
-                        nHit++;
-                    }
+                    ys.col(numInside++) = y;
+                }
+            }
+
+            std::vector<Pattern> ptns;
+            evaluate(ys.leftCols(numInside), ptns);
+            for (Pattern cPtn : ptns) {
+                if (cPtn == regions.patterns[i]) {
+                    nHit++;
                 }
             }
 
@@ -384,5 +442,5 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
               << numTrials << " trials) ELASPED.\n"
               "=================================================================\n");
 
-    return { resultPatterns, resultXs, resultXMean, resultXCovMat };
+    return { resultPatterns, resultXs, resultXMean, resultXCovMat, xMin, xMax };
 }
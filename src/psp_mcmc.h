@@ -19,7 +19,9 @@
 using Point = Eigen::VectorXd;
 using Points = std::vector<Point>;
 using Pattern = size_t;
-using Model = std::function<Pattern(Point)>;
+using Model = std::function<Pattern(Point const&)>;
+// finds the patterns of the points given as columns
+using Batch_Model = std::function<void(Eigen::Ref<const Eigen::MatrixXd>, Pattern*)>;
 
 
 namespace PSP {
@@ -50,19 +52,42 @@ typedef enum PSP_Result_Mode_ {
     PSP_RESULT_COMBINE  //XXX: Only correctly combines the lists of sampled points!
 } PSP_Result_Mode;
 
+typedef enum PSP_Sample_Encoding_ {
+    PSP_SAMPLE_DOUBLE,
+    PSP_SAMPLE_FIXED32,
+    PSP_SAMPLE_FIXED16
+} PSP_Sample_Encoding;
+
 #ifdef __cplusplus
 }
 
+#include "sample_store.h"
+
 struct PSP_Result {
     std::vector<Pattern> patterns;
-    std::vector<Points> xs;
+    std::vector<Sample_Store> xs;
     std::vector<Eigen::VectorXd> xMean;
     std::vector<Eigen::MatrixXd> xCovMat;
+    Point xMin;
+    Point xMax;
 };
 
 size_t nDim(PSP_Result const& psp_result);
 
-PSP_Result psp_mcmc(Model model, Eigen::MatrixXd x0, Eigen::MatrixX2d xBounds, PSP_Options options = PSP_Options());
+class Sample_Stream;
+
+/**
+ * Searches the regions of the model. Every accepted sample is also given to
+ * `stream` if not NULL; unless `retain_samples`, the regions then only keep
+ * the current point of their chain. The samples are kept as set by
+ * `storage`, in memory if NULL. If `batch_model` is set, it is used instead
+ * of `model` where several points can be evaluated at once: the starting
+ * points and the volume estimation.
+ */
+PSP_Result psp_mcmc(Model model, Eigen::MatrixXd x0, Eigen::MatrixX2d xBounds, PSP_Options options = PSP_Options(),
+                    Sample_Stream* stream = NULL, bool retain_samples = true,
+                    std::shared_ptr<const Sample_Storage> storage = nullptr,
+                    Batch_Model batch_model = nullptr);
 #endif
 
 #endif
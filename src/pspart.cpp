@@ -16,6 +16,11 @@ static int HandleExceptions() noexcept
         fprintf(stderr, "PSP: Invalid argument: %s.\n", err.what());
         return EINVAL;
     }
+    catch (std::system_error const& err)
+    {
+        fprintf(stderr, "PSP: %s.\n", err.what());
+        return err.code().value();
+    }
     catch (PSP::too_many_patterns const& err)
     {
         fprintf(stderr, "PSP: Too many patterns found in model.\n");
@@ -34,20 +39,25 @@ struct PSP_Handle_ {
     PSP_Result psp_regions;
     svm_parameter* svm_params;
     PSP_Memory memory;
+    std::unique_ptr<Surrogate> surrogate;
+    PSP_Sample_SinkRec sample_sink;
+    bool discard_samples;
+    std::shared_ptr<const Sample_Storage> sample_storage;
+    PSP_ExecutorRec executor;
 };
 
 using Point_Fixed = Eigen::VectorX<Fixed>;
 
 static inline
-Point map_coord(PSP_Handle handle, Fixed* coord)
+Point map_point(PSP_Handle handle, Fixed const* coord)
 {
-    return Eigen::Map<Point_Fixed>(coord, handle->n_dim).cast<double>() / 65536.0;
+    return Eigen::Map<const Point_Fixed>(coord, handle->n_dim).unaryExpr([](Fixed c) { return map_coord(c); });
 }
 
 static inline
-Point_Fixed unmap_coord(Point const& coord)
+Point_Fixed unmap_point(Point const& coord)
 {
-    return (coord * 65536).cast<Fixed>();
+    return coord.unaryExpr([](double c) { return unmap_coord(c); });
 }
 
 template <typename T>
@@ -64,6 +74,96 @@ void append(std::vector<T> & dest, std::vector<T> src)
 }
 
 
+/**
+ * Keeps the previous models from being reused by the next builds, as the
+ * regions they were trained on were replaced.
+ */
+static void retire_models(PSP_Handle handle)
+{
+    PSP_Memory memory = handle->memory;
+    if (!memory)
+        return;
+    if (memory->kdsvm) {
+        memory->retired_kdsvm = std::move(memory->kdsvm);
+    }
+    if (memory->mcsvm) {
+        memory->retired_mcsvm = std::move(memory->mcsvm);
+    }
+}
+
+/**
+ * Merges the regions found by a search into those of the handle, as
+ * described for `PSP_Get_Regions`.
+ */
+static void merge_regions(PSP_Handle handle,
+                          PSP_Result const& result,
+                          PSP_Result_Mode result_mode)
+{
+    if (result_mode == PSP_RESULT_OVERWRITE) {
+        retire_models(handle);
+    }
+
+    switch (result_mode) {
+    default:
+    case PSP_RESULT_OVERWRITE:
+        handle->psp_regions = result;
+        break;
+
+    case PSP_RESULT_APPEND:
+        append(handle->psp_regions.patterns, result.patterns);
+        append(handle->psp_regions.xs, result.xs);
+        append(handle->psp_regions.xMean, result.xMean);
+        append(handle->psp_regions.xCovMat, result.xCovMat);
+        break;
+
+    case PSP_RESULT_COMBINE:
+    {
+        std::vector<size_t> idxs(result.patterns.size());
+        std::transform(result.patterns.begin(), result.patterns.end(),
+                       idxs.begin(),
+                       [handle](Pattern const& ptn) {
+                           auto it = std::find(handle->psp_regions.patterns.rbegin(),
+                                               handle->psp_regions.patterns.rend(),
+                                               ptn);
+                           return handle->psp_regions.patterns.rend() - it - 1;
+                       });
+
+        for (int i = 0; i < result.patterns.size(); i++) {
+            int idx = idxs[i];
+
+            if (idx == -1) {
+                handle->psp_regions.patterns.push_back(result.patterns[i]);
+                handle->psp_regions.xs.push_back(result.xs[i]);
+                handle->psp_regions.xMean.push_back(result.xMean[i]);
+                handle->psp_regions.xCovMat.push_back(result.xCovMat[i]);
+            } else {
+                int a = handle->psp_regions.xs[idx].size();
+                int b = result.xs[i].size();
+                Point x = handle->psp_regions.xMean[idx];
+                Point y = result.xMean[i];
+
+                handle->psp_regions.xs[idx].append(result.xs[i]);
+                handle->psp_regions.xMean[idx] = (a*x + b*y) / (a + b);
+            }
+        }
+    }
+        break;
+    }
+
+    PSP_Result& regions = handle->psp_regions;
+    if (result_mode != PSP_RESULT_OVERWRITE && regions.xMin.size() > 0) {
+        // imported regions may come without bounds
+        if (result.xMin.size() > 0) {
+            regions.xMin = regions.xMin.cwiseMin(result.xMin);
+            regions.xMax = regions.xMax.cwiseMax(result.xMax);
+        }
+    } else {
+        regions.xMin = result.xMin;
+        regions.xMax = result.xMax;
+    }
+}
+
+
 extern "C"
 PSP_Handle PSP_New(size_t dim)
 {
@@ -83,6 +183,15 @@ PSP_Handle PSP_New(size_t dim)
     return handle;
 }
 
+extern "C"
+void PSP_Free_Models(PSP_Handle handle)
+{
+    if (!handle)
+        return;
+    delete handle->memory;
+    handle->memory = NULL;
+}
+
 extern "C"
 void PSP_Close(PSP_Handle handle)
 {
@@ -92,6 +201,38 @@ void PSP_Close(PSP_Handle handle)
     delete handle;
 }
 
+/**
+ * Searches the regions of a model from starting points given as columns,
+ * streaming the samples to the sink of the handle, and merges them into its
+ * regions.
+ */
+static void get_regions(PSP_Handle handle,
+                        Model model,
+                        Batch_Model batch_model,
+                        Eigen::MatrixXd const& x0,
+                        Eigen::MatrixX2d const& xb,
+                        PSP_Options options,
+                        PSP_Result_Mode result_mode)
+{
+    Executor_Scope scope(handle->executor);
+
+    std::unique_ptr<Sample_Stream> stream;
+    if (handle->sample_sink.consume || handle->sample_sink.consume_double) {
+        // with an executor, the library starts no thread of its own
+        stream.reset(new Sample_Stream(handle->sample_sink, handle->n_dim,
+                                       !handle->executor.submit));
+    }
+
+    PSP_Result const& result = psp_mcmc(model, x0, xb, options,
+                                        stream.get(), !handle->discard_samples,
+                                        handle->sample_storage, batch_model);
+    if (stream) {
+        stream->finish();
+    }
+
+    merge_regions(handle, result, result_mode);
+}
+
 extern "C"
 int PSP_Get_Regions(PSP_Handle handle,
                     PSP_Sampling_Callback sampling_callback,
@@ -106,66 +247,158 @@ int PSP_Get_Regions(PSP_Handle handle,
         return EINVAL;
 
     try {
-        auto model = [sampling_callback](Point x) {
+        auto model = [sampling_callback](Point const& x) {
             return sampling_callback->sampler(sampling_callback->sampling_context,
-                                              unmap_coord(x).data());
+                                              unmap_point(x).data());
         };
 
         Eigen::MatrixXd x0(handle->n_dim, num_start_points);
         for (int i = 0; i < num_start_points; i++) {
-            x0.col(i) = map_coord(handle, start_points + i * handle->n_dim);
+            x0.col(i) = map_point(handle, start_points + i * handle->n_dim);
         }
         Eigen::MatrixX2d xb(handle->n_dim, 2);
-        xb << map_coord(handle, min_coords), map_coord(handle, max_coords);
-
-        PSP_Result const& result = psp_mcmc(model, x0, xb, options);
-
-        switch (result_mode) {
-        default:
-        case PSP_RESULT_OVERWRITE:
-            handle->psp_regions = result;
-            break;
-
-        case PSP_RESULT_APPEND:
-            append(handle->psp_regions.patterns, result.patterns);
-            append(handle->psp_regions.xs, result.xs);
-            append(handle->psp_regions.xMean, result.xMean);
-            append(handle->psp_regions.xCovMat, result.xCovMat);
-            break;
-
-        case PSP_RESULT_COMBINE:
-        {
-            std::vector<size_t> idxs(result.patterns.size());
-            std::transform(result.patterns.begin(), result.patterns.end(),
-                           idxs.begin(),
-                           [handle](Pattern const& ptn) {
-                               auto it = std::find(handle->psp_regions.patterns.rbegin(),
-                                                   handle->psp_regions.patterns.rend(),
-                                                   ptn);
-                               return handle->psp_regions.patterns.rend() - it - 1;
-                           });
-
-            for (int i = 0; i < result.patterns.size(); i++) {
-                int idx = idxs[i];
-
-                if (idx == -1) {
-                    handle->psp_regions.patterns.push_back(result.patterns[i]);
-                    handle->psp_regions.xs.push_back(result.xs[i]);
-                    handle->psp_regions.xMean.push_back(result.xMean[i]);
-                    handle->psp_regions.xCovMat.push_back(result.xCovMat[i]);
-                } else {
-                    int a = handle->psp_regions.xs[idx].size();
-                    int b = result.xs[i].size();
-                    Point x = handle->psp_regions.xMean[idx];
-                    Point y = result.xMean[i];
-
-                    append(handle->psp_regions.xs[idx], result.xs[i]);
-                    handle->psp_regions.xMean[idx] = (a*x + b*y) / (a + b);
-                }
-            }
-        }
-            break;
+        xb << map_point(handle, min_coords), map_point(handle, max_coords);
+
+        get_regions(handle, model, nullptr, x0, xb, options, result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Get_Regions_Double(PSP_Handle handle,
+                           PSP_Sampling_Callback_Double sampling_callback,
+                           int num_start_points,
+                           const double* start_points,
+                           const double* min_coords,
+                           const double* max_coords,
+                           PSP_Options options,
+                           PSP_Result_Mode result_mode)
+{
+    if (!handle || !sampling_callback ||
+        (!sampling_callback->sampler && !sampling_callback->batch_sampler) ||
+        num_start_points < 0 || (num_start_points > 0 && !start_points) ||
+        !min_coords || !max_coords)
+        return EINVAL;
+
+    try {
+        PSP_Sampling_Callback_DoubleRec callback = *sampling_callback;
+
+        // the points are given from where the search keeps them
+        Model model = [callback](Point const& x) {
+            if (callback.sampler)
+                return callback.sampler(callback.sampling_context, x.data());
+            size_t pattern;
+            callback.batch_sampler(callback.sampling_context, 1, x.data(), &pattern);
+            return pattern;
+        };
+        Batch_Model batch_model;
+        if (callback.batch_sampler) {
+            batch_model = [callback](Eigen::Ref<const Eigen::MatrixXd> points, Pattern* patterns) {
+                callback.batch_sampler(callback.sampling_context, points.cols(), points.data(), patterns);
+            };
         }
+
+        size_t dim = handle->n_dim;
+        Eigen::MatrixXd x0 = Eigen::Map<const Eigen::MatrixXd>(start_points, dim, num_start_points);
+        Eigen::MatrixX2d xb(dim, 2);
+        xb << Eigen::Map<const Point>(min_coords, dim), Eigen::Map<const Point>(max_coords, dim);
+
+        get_regions(handle, model, batch_model, x0, xb, options, result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+
+extern "C"
+int PSP_Set_Sample_Sink(PSP_Handle handle,
+                        PSP_Sample_Sink sink,
+                        int retain_samples)
+{
+    if (!handle)
+        return EINVAL;
+
+    handle->sample_sink = sink ? *sink : PSP_Sample_SinkRec{};
+    handle->discard_samples = (handle->sample_sink.consume || handle->sample_sink.consume_double)
+                           && !retain_samples;
+
+    return 0;
+}
+
+extern "C"
+int PSP_Set_Sample_Storage(PSP_Handle handle,
+                           const char* spill_dir,
+                           size_t tail_bytes)
+{
+    if (!handle)
+        return EINVAL;
+
+    try {
+        Sample_Storage storage = handle->sample_storage ? *handle->sample_storage : Sample_Storage{};
+        storage.spill_dir = spill_dir ? spill_dir : "";
+        storage.tail_bytes = std::max(tail_bytes, SAMPLE_MIN_TAIL_BYTES);
+        handle->sample_storage = std::make_shared<Sample_Storage>(std::move(storage));
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Set_Sample_Encoding(PSP_Handle handle,
+                            PSP_Sample_Encoding encoding)
+{
+    if (!handle)
+        return EINVAL;
+    if (encoding != PSP_SAMPLE_DOUBLE && encoding != PSP_SAMPLE_FIXED32 &&
+        encoding != PSP_SAMPLE_FIXED16)
+        return EINVAL;
+
+    try {
+        Sample_Storage storage = handle->sample_storage ? *handle->sample_storage : Sample_Storage{};
+        storage.encoding = encoding;
+        handle->sample_storage = std::make_shared<Sample_Storage>(std::move(storage));
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Export_Result(PSP_Handle handle,
+                      const char* path)
+{
+    if (!handle || !path)
+        return EINVAL;
+
+    try {
+        export_result(handle->psp_regions, handle->n_dim, path);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Import_Result(PSP_Handle handle,
+                      const char* path,
+                      PSP_Result_Mode result_mode)
+{
+    if (!handle || !path)
+        return EINVAL;
+
+    try {
+        // the imported samples may have the counts of those of the models
+        retire_models(handle);
+        merge_regions(handle, import_result(path, handle->n_dim, handle->sample_storage), result_mode);
     } catch (...) {
         return HandleExceptions();
     }
@@ -186,6 +419,25 @@ int PSP_Configure_SVM(PSP_Handle handle,
     return 0;
 }
 
+extern "C"
+int PSP_Tune_SVM(PSP_Handle handle,
+                 PSP_SVM_Grid grid,
+                 int nfold,
+                 struct svm_parameter* out_params)
+{
+    if (!handle || !grid || !out_params)
+        return EINVAL;
+
+    try {
+        Executor_Scope scope(handle->executor);
+        *out_params = tune_svm(handle->psp_regions, handle->svm_params, *grid, nfold);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
 extern "C"
 int PSP_Build_Partition_KdSVM(PSP_Handle handle,
                               PSP_KdSVMTree* tree)
@@ -194,6 +446,7 @@ int PSP_Build_Partition_KdSVM(PSP_Handle handle,
         return EINVAL;
 
     try {
+        Executor_Scope scope(handle->executor);
         if (!handle->memory)
             handle->memory = new PSP_MemoryRec{};
         *tree = build_kdsvm(handle->psp_regions, handle->svm_params, handle->memory);
@@ -204,6 +457,27 @@ int PSP_Build_Partition_KdSVM(PSP_Handle handle,
     return 0;
 }
 
+extern "C"
+size_t PSP_Predict_KdSVM(PSP_KdSVMTree tree,
+                         const struct svm_node* x)
+{
+    return predict_kdsvm(tree, x);
+}
+
+extern "C"
+int PSP_Get_KdSVM_Stats(PSP_KdSVMTree tree,
+                        PSP_KdSVM_Node_StatsRec* stats,
+                        size_t max_nodes,
+                        size_t* num_nodes)
+{
+    if (!tree || (max_nodes > 0 && !stats) || !num_nodes)
+        return EINVAL;
+
+    *num_nodes = kdsvm_node_stats(tree, stats, max_nodes);
+
+    return 0;
+}
+
 extern "C"
 int PSP_Build_Partition_MCSVM(PSP_Handle handle,
                               PSP_MCSVM* node)
@@ -212,6 +486,7 @@ int PSP_Build_Partition_MCSVM(PSP_Handle handle,
         return EINVAL;
 
     try {
+        Executor_Scope scope(handle->executor);
         if (!handle->memory)
             handle->memory = new PSP_MemoryRec{};
         *node = build_mcsvm(handle->psp_regions, handle->svm_params, handle->memory);
@@ -222,6 +497,362 @@ int PSP_Build_Partition_MCSVM(PSP_Handle handle,
     return 0;
 }
 
+extern "C"
+int PSP_Build_Partition_KNN(PSP_Handle handle,
+                            int k,
+                            size_t max_per_region,
+                            PSP_Partition* partition)
+{
+    if (!handle || k <= 0 || !partition)
+        return EINVAL;
+
+    try {
+        *partition = build_knn(handle->psp_regions, k, max_per_region);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Compile_KdSVM(PSP_KdSVMTree tree,
+                      PSP_Partition* partition)
+{
+    if (!tree || !partition)
+        return EINVAL;
+
+    try {
+        *partition = compile_kdsvm(tree);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Compile_MCSVM(PSP_MCSVM node,
+                      PSP_Partition* partition)
+{
+    if (!node || !partition)
+        return EINVAL;
+
+    try {
+        *partition = compile_mcsvm(node);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Copy_Partition(PSP_Partition partition,
+                       PSP_Partition* copy)
+{
+    if (!partition || !copy)
+        return EINVAL;
+
+    try {
+        *copy = copy_partition(partition);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+size_t PSP_Predict(PSP_Partition partition,
+                   const struct svm_node* x)
+{
+    return predict_partition(partition, x);
+}
+
+extern "C"
+int PSP_Set_Fast_Predict(PSP_Partition partition,
+                         int enable)
+{
+    if (!partition)
+        return EINVAL;
+
+    for (auto& node : partition->nodes) {
+        if (node.predictor)
+            node.predictor->fast = enable != 0;
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Get_Flat_KdSVM(PSP_Partition partition,
+                       PSP_Flat_KdSVMRec* flat)
+{
+    if (!partition || !flat || partition->multiclass || partition->knn)
+        return EINVAL;
+
+    *flat = flat_kdsvm(partition);
+
+    return 0;
+}
+
+extern "C"
+int PSP_Save_Partition(PSP_Partition partition,
+                       const char* path)
+{
+    if (!partition || !path)
+        return EINVAL;
+
+    try {
+        save_partition(partition, path);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Load_Partition(const char* path,
+                       PSP_Partition* partition)
+{
+    if (!path || !partition)
+        return EINVAL;
+
+    try {
+        *partition = load_partition(path);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Export_C(PSP_Partition partition,
+                 const char* path)
+{
+    if (!partition || !path)
+        return EINVAL;
+
+    try {
+        export_c(partition, path);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Predict_Batch(PSP_Partition partition,
+                      size_t num_points,
+                      const Fixed* points,
+                      size_t* patterns_out,
+                      int num_threads)
+{
+    if (!partition || (num_points > 0 && (!points || !patterns_out)) || num_threads < 0)
+        return EINVAL;
+
+    try {
+        Executor_Scope scope(partition->executor);
+        predict_batch(partition, num_points, points, patterns_out, num_threads);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+void PSP_Free_Partition(PSP_Partition partition)
+{
+    delete partition;
+}
+
+extern "C"
+int PSP_Build_Lookup_Grid(PSP_Partition partition,
+                          int max_depth,
+                          const Fixed* xMin,
+                          const Fixed* xMax,
+                          int num_samples,
+                          PSP_Lookup_Grid* grid)
+{
+    if (!partition || !xMin || !xMax || !grid)
+        return EINVAL;
+
+    try {
+        *grid = build_lookup_grid(partition, xMin, xMax, max_depth, num_samples);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+size_t PSP_Lookup(PSP_Lookup_Grid grid,
+                  const Fixed* point)
+{
+    return lookup_grid(grid, point);
+}
+
+extern "C"
+void PSP_Free_Lookup_Grid(PSP_Lookup_Grid grid)
+{
+    delete grid;
+}
+
+extern "C"
+int PSP_Configure_Surrogate(PSP_Handle handle,
+                            PSP_Partition partition,
+                            PSP_Sampling_Callback sampling_callback,
+                            double min_margin,
+                            size_t max_cache)
+{
+    if (!handle || !partition || !sampling_callback || !sampling_callback->sampler ||
+        partition->dim != handle->n_dim)
+        return EINVAL;
+
+    try {
+        std::unique_ptr<Surrogate> surrogate(new Surrogate{});
+        surrogate->partition.reset(copy_partition(partition));
+        PSP_Sampling_CallbackRec callback = *sampling_callback;
+        surrogate->model = [callback](Fixed* point) {
+            return callback.sampler(callback.sampling_context, point);
+        };
+        surrogate->min_margin = min_margin;
+        surrogate->max_cache = max_cache;
+        handle->surrogate = std::move(surrogate);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Query_Surrogate(PSP_Handle handle,
+                        const Fixed* point,
+                        size_t* pattern,
+                        double* confidence)
+{
+    if (!handle || !handle->surrogate || !point || !pattern)
+        return EINVAL;
+
+    try {
+        Surrogate_Answer answer = query_surrogate(*handle->surrogate, point);
+        *pattern = answer.pattern;
+        if (confidence)
+            *confidence = answer.confidence;
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Get_Surrogate_Stats(PSP_Handle handle,
+                            PSP_Surrogate_Stats stats)
+{
+    if (!handle || !handle->surrogate || !stats)
+        return EINVAL;
+
+    *stats = handle->surrogate->stats;
+
+    return 0;
+}
+
+
+extern "C"
+int PSP_Set_Executor(PSP_Handle handle,
+                     PSP_Submit_Func submit,
+                     void* executor_context)
+{
+    if (!handle)
+        return EINVAL;
+
+    handle->executor = PSP_ExecutorRec{ executor_context, submit };
+
+    return 0;
+}
+
+extern "C"
+int PSP_Set_Partition_Executor(PSP_Partition partition,
+                               PSP_Submit_Func submit,
+                               void* executor_context)
+{
+    if (!partition)
+        return EINVAL;
+
+    partition->executor = PSP_ExecutorRec{ executor_context, submit };
+
+    return 0;
+}
+
+extern "C"
+PSP_Job_Pool PSP_New_Job_Pool(size_t num_threads)
+{
+    PSP_Job_Pool pool = NULL;
+
+    try {
+        pool = new PSP_Job_Pool_(num_threads);
+    } catch (...) {
+        fprintf(stderr, "PSP_New_Job_Pool: failed with code %d",
+                HandleExceptions());
+        pool = NULL;
+    }
+
+    return pool;
+}
+
+extern "C"
+void PSP_Close_Job_Pool(PSP_Job_Pool pool)
+{
+    delete pool;
+}
+
+extern "C"
+int PSP_Submit_Job(PSP_Job_Pool pool,
+                   PSP_Handle handle,
+                   PSP_Job_Func run,
+                   void* job_context,
+                   PSP_Job* job)
+{
+    if (!pool || !handle || !run || !job)
+        return EINVAL;
+
+    try {
+        *job = pool->submit(handle, run, job_context);
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Wait_Job(PSP_Job_Pool pool,
+                 PSP_Job job,
+                 int* result)
+{
+    if (!pool || !job)
+        return EINVAL;
+
+    try {
+        int job_result = pool->wait(job);
+        if (result) {
+            *result = job_result;
+        }
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
 
 extern "C"
 void psp_dump_points(PSP_Handle handle)
@@ -231,10 +862,28 @@ void psp_dump_points(PSP_Handle handle)
     for (size_t i = 0; i < handle->psp_regions.patterns.size(); i++) {
         std::cout << handle->psp_regions.patterns[i] << ' '
                   << handle->psp_regions.xs[i].size() << '\n'
-                  << unmap_coord(handle->psp_regions.xMean[i]).transpose() << '\n';
-        for (auto & x : handle->psp_regions.xs[i]) {
-            std::cout << unmap_coord(x).transpose() << '\n';
-        }
+                  << unmap_point(handle->psp_regions.xMean[i]).transpose() << '\n';
+        handle->psp_regions.xs[i].for_each([](Eigen::Map<const Point> x) {
+            std::cout << unmap_point(x).transpose() << '\n';
+        });
+    }
+#endif
+}
+
+
+extern "C"
+void psp_dump_solver_stats(PSP_KdSVMTree tree)
+{
+#ifdef DEBUG
+    std::vector<PSP_KdSVM_Node_StatsRec> stats(kdsvm_node_stats(tree, NULL, 0));
+    kdsvm_node_stats(tree, stats.data(), stats.size());
+
+    std::cout << "Solver statistics dump:\n";
+    for (auto const& node : stats) {
+        std::cout << node.depth << ' ' << node.num_SVs << ' ' << node.solver.iter << ' '
+                  << node.solver.time << ' ' << node.solver.eps << ' ' << node.solver.status << ' '
+                  << node.reduction.l << ' ' << node.reduction.agreement << ' '
+                  << node.reduction.speedup << '\n';
     }
 #endif
 }
@@ -10,10 +10,18 @@
 #include "common.h"
 #include "buildpart.h"
 #include "psp_mcmc.h"
+#include "tune_svm.h"
+#include "partition.h"
+#include "partition_file.h"
+#include "result_file.h"
+#include "sample_sink.h"
+#include "lookup_grid.h"
+#include "surrogate.h"
+#include "export_c.h"
+#include "parallel.h"
+#include "job_pool.h"
 
 
-typedef long Fixed;
-
 typedef struct PSP_Handle_ *PSP_Handle;
 
 
@@ -30,6 +38,35 @@ typedef struct PSP_Sampling_CallbackRec_ {
     Sampling_Func sampler;
 } PSP_Sampling_CallbackRec, *PSP_Sampling_Callback;
 
+/**
+ * Returns the data pattern of a point, given in doubles, see
+ * `PSP_Get_Regions_Double`.
+ */
+typedef size_t (*Sampling_Func_Double)(void* sampling_context,
+                                       const double* point);
+
+/**
+ * Stores in `patterns` the data patterns of `num_points` points, given in
+ * doubles one after the other.
+ */
+typedef void (*Sampling_Batch_Func)(void* sampling_context,
+                                    size_t num_points,
+                                    const double* points,
+                                    size_t* patterns);
+
+typedef struct PSP_Sampling_Callback_DoubleRec_ {
+    void* sampling_context;
+    Sampling_Func_Double sampler;
+    Sampling_Batch_Func batch_sampler;
+} PSP_Sampling_Callback_DoubleRec, *PSP_Sampling_Callback_Double;
+
+
+/*
+ * Distinct handles, and what is built from them, may be used concurrently
+ * from different threads; a handle or a partition must not be used by two
+ * threads at once, see `PSP_Copy_Partition`. `PSP_Submit_Job` runs the jobs
+ * of many handles on a shared pool of threads.
+ */
 
 /** Allocates a new instance of PSP */
 PSP_Handle PSP_New(size_t dim);
@@ -82,6 +119,114 @@ int PSP_Get_Regions(PSP_Handle handle,
                     PSP_Options options,
                     PSP_Result_Mode result_mode);
 
+/**
+ * Same as `PSP_Get_Regions`, with the points in doubles instead of fixed
+ * point: the starting points one after the other, the bounds, and the points
+ * given to the callback, which are those of the search without conversion.
+ * The samples of the regions are the points given to the callback.
+ *
+ * Either callback function may be NULL. The batch one, if set, is given the
+ * points that can be evaluated at once: the starting points, and the points
+ * of the volume estimation of each region. The other points are given to
+ * `sampler`, or to `batch_sampler` one by one if it is NULL. The points
+ * given to a callback are only valid during the call.
+ */
+int PSP_Get_Regions_Double(PSP_Handle handle,
+                           PSP_Sampling_Callback_Double sampling_callback,
+                           int num_start_points,
+                           const double* start_points,
+                           const double* min_coords,
+                           const double* max_coords,
+                           PSP_Options options,
+                           PSP_Result_Mode result_mode);
+
+/**
+ * Streams the samples accepted by the following calls to `PSP_Get_Regions`
+ * and `PSP_Get_Regions_Double` to `sink`, or stops streaming if `sink` is
+ * NULL. The sink is called on a thread of its own with batches of samples of
+ * one region, the index of the region in the search and its pattern, in fixed
+ * point, or in doubles with `consume_double`, which keeps the coordinates of
+ * searches in doubles exact; the batches of a region arrive in the order of
+ * the samples, and all of them before the search returns. The search waits
+ * when the sink falls too far behind. If the handle has an executor, the
+ * sink is called from the thread of the search instead, as each batch fills.
+ *
+ * Unless `retain_samples`, the sampled regions of the handle only keep the
+ * last sample of each region, besides its mean and covariance, so that the
+ * memory of a search does not grow with its length; the samples must then be
+ * stored by the sink to build a partition.
+ */
+int PSP_Set_Sample_Sink(PSP_Handle handle,
+                        PSP_Sample_Sink sink,
+                        int retain_samples);
+
+/**
+ * Keeps the samples of the following calls to `PSP_Get_Regions` and
+ * `PSP_Import_Result` in segment files in the directory `spill_dir`, or in
+ * memory if it is NULL. For each region, up to `tail_bytes` bytes of the
+ * latest samples, at least 64 KiB, are kept in memory; beyond that they are
+ * written to a new segment file, which is mapped read-only and unlinked at
+ * once so that it disappears with the handle or when the process ends.
+ * Partitions are built by reading the segments sequentially through their
+ * mappings, so that a search can keep more samples than fit in memory.
+ *
+ * Each segment file takes a mapping, and processes have a limit on them,
+ * e.g. `vm.max_map_count`, 65530 by default on Linux. The last segments of a
+ * region are thus merged into the new one while they are not larger than
+ * it: a region keeps about log2(n / tail_bytes) segments for n bytes of
+ * samples, each sample being written as many times.
+ */
+int PSP_Set_Sample_Storage(PSP_Handle handle,
+                           const char* spill_dir,
+                           size_t tail_bytes);
+
+/**
+ * Sets how the samples of the following calls to `PSP_Get_Regions` and
+ * `PSP_Import_Result` are kept. `PSP_SAMPLE_DOUBLE`, the default, keeps the
+ * coordinates as given by the search. `PSP_SAMPLE_FIXED32` and
+ * `PSP_SAMPLE_FIXED16` round them to fixed point, as given to the sampling
+ * callback of `PSP_Get_Regions`, and keep them as 32- or 16-bit offsets from
+ * the minimum coordinates of the search, taking a half or a quarter of the
+ * memory and of the segment files. Only the stored samples are rounded: the
+ * chains and the means and covariances of the search use the points given to
+ * the callback. The offsets are in fixed point units, unless the bounds span
+ * more values than the encoding has: coordinates are then rounded down to as
+ * many evenly spaced values, e.g. to 3 units for 16-bit offsets on bounds 2
+ * apart. The stored samples are thus the points the callback was called with
+ * only for searches with the fixed point callback whose bounds fit the
+ * encoding, as with `PSP_SAMPLE_FIXED32` for bounds less than 65536 apart.
+ * Samples are decoded when a partition is built or the regions exported.
+ * Imported regions without bounds are kept in doubles.
+ */
+int PSP_Set_Sample_Encoding(PSP_Handle handle,
+                            PSP_Sample_Encoding encoding);
+
+/**
+ * Writes the sampled regions to a binary file, without the text conversion
+ * of `psp_dump_points`. The file has one array per field, each aligned to 64
+ * bytes: the patterns and sample counts of the regions as 64-bit integers,
+ * then their means, their covariance matrices (column by column), the search
+ * bounds and the samples of all regions one after the other, as doubles
+ * equal to the fixed point coordinates divided by 65536. Samples are written
+ * from where they are stored, without being copied first. Returns the errno
+ * of the failure if the file cannot be written.
+ */
+int PSP_Export_Result(PSP_Handle handle,
+                      const char* path);
+
+/**
+ * Reads a file written by `PSP_Export_Result` on a platform with the same
+ * byte order into the sampled regions, as if returned by a search in the
+ * given mode; the `PSP_Build_Partition_*` functions can then be used as
+ * after `PSP_Get_Regions`. The file is mapped and its arrays copied into the
+ * regions. Returns EINVAL if the file is not a valid result file of the
+ * dimension of the handle, and the errno of the failure if it cannot be
+ * mapped.
+ */
+int PSP_Import_Result(PSP_Handle handle,
+                      const char* path,
+                      PSP_Result_Mode result_mode);
+
 /**
  * Configures the next SVM instance to be run. The settings are persistent
  * between calls. If this function is not used before starting an SVM
@@ -104,31 +249,361 @@ int PSP_Get_Regions(PSP_Handle handle,
  *   double eps = 1e-3;        // stopping criteria
  *   int shrinking = 1;        // use the shrinking heuristics
  *   int probability = 0;      // (unused) do probability estimates
+ *   double linear_tol = 0;    // KdSVM: use a linear split if its training
+ *                             // error rate is at most this, so only if it
+ *                             // separates the training set when 0, as in a
+ *                             // zero-initialized structure; < 0 to disable
+ *   int standardize = STANDARDIZE_NONE;
+ *                             // scale the points before training, either
+ *                             // mapping the search bounds to [-1, 1]
+ *                             // (STANDARDIZE_BOUNDS) or to zero mean and unit
+ *                             // variance (STANDARDIZE_SAMPLES); the trained
+ *                             // models still take the original coordinates
+ *   int max_iter = 0;         // solver iterations per decision function,
+ *                             // 0 for the libsvm default
+ *   double max_time = 0;      // wall time of each SVM training in seconds,
+ *                             // 0 for no limit; the solution reached by then
+ *                             // is used
+ *   double eps_coarse = 0;    // if larger than eps, solve to this tolerance
+ *                             // first and then ten times finer down to eps,
+ *                             // stopping early once the predictions at the
+ *                             // training points no longer change
+ *   double reduce_tol = 0;    // if positive, the MCSVM model and the kernel
+ *                             // nodes of a KdSVM are approximated with
+ *                             // fewer SVs, changing the predictions of at
+ *                             // most this fraction of their training set
  * };
+ *
+ * The solver statistics of each trained model are in `model->stats`, and the
+ * number of SVs before reduction, the agreement with the original model and
+ * the measured speedup in `model->reduction`. Rebuilds warm start from the
+ * original models.
  */
 int PSP_Configure_SVM(PSP_Handle handle,
                       struct svm_parameter* params);
 
+/**
+ * Searches the grid of SVM parameters for the set with the lowest stratified
+ * `nfold`-fold cross validation error of the multi-class problem on the
+ * sampled regions. Must be called only after using `PSP_Get_Regions`.
+ *
+ * The parameters not in the grid, as well as the SVM and kernel types, are
+ * taken from the configured parameters, and the best set is written to
+ * `out_params`, which can be passed to `PSP_Configure_SVM`. The `C` values are
+ * only tried for C_SVC and the `nu` values for NU_SVC.
+ *
+ * Grid points and folds are evaluated in parallel, on a sample of at most
+ * a few thousand points. The kernel values are computed once for all folds
+ * and penalties with the same kernel parameters, and a grid point is
+ * abandoned once its errors exceed those of the best complete one.
+ */
+int PSP_Tune_SVM(PSP_Handle handle,
+                 PSP_SVM_Grid grid,
+                 int nfold,
+                 struct svm_parameter* out_params);
+
 /**
  * Builds a partition of the space according to the sampled regions. Must be
  * called only after using `PSP_Get_Regions`.
  *
  * This method creates a binary space partitioning with SVM to estimate the
- * plane of separation between half-spaces.
+ * plane of separation between half-spaces. Each node splits its regions along
+ * the axis and position whose halves are expected to be the easiest to
+ * separate linearly, favouring splits that balance points and regions.
+ *
+ * When called again after a search in append or combine mode, nodes whose
+ * regions received no new samples are kept as they were, and the other kernel
+ * nodes are retrained starting from their previous solution; after a search
+ * in overwrite mode or an import, the tree is built anew. The tree returned
+ * by the previous call must not be used afterwards.
  */
 int PSP_Build_Partition_KdSVM(PSP_Handle handle,
                               PSP_KdSVMTree* tree);
 
+/**
+ * Finds the data pattern of the leaf of a KdSVM tree containing the given
+ * point. Linear splits are evaluated with a plain dot product.
+ */
+size_t PSP_Predict_KdSVM(PSP_KdSVMTree tree,
+                         const struct svm_node* x);
+
+/**
+ * Gives the training statistics of the inner nodes of a KdSVM tree in
+ * depth-first order: those of the first `max_nodes` nodes are stored in
+ * `stats` and the number of inner nodes in `num_nodes`, so that it can be
+ * called with `max_nodes` 0 to size the array. The statistics are those of
+ * the models used for prediction, see `PSP_Configure_SVM`.
+ */
+int PSP_Get_KdSVM_Stats(PSP_KdSVMTree tree,
+                        PSP_KdSVM_Node_StatsRec* stats,
+                        size_t max_nodes,
+                        size_t* num_nodes);
+
 /**
  * Builds a single multi-class SVM instance according to the sampled regions.
  * Must be called only after using `PSP_Get_Regions`.
  *
  * This method creates a single node which contains the multi-class SVM model,
  * using a one-against-one strategy.
+ *
+ * When called again after a search in append or combine mode, the previous
+ * model is returned if no region received new samples; otherwise only the
+ * class pairs involving changed regions are retrained, starting from their
+ * previous solution; after a search in overwrite mode or an import, the model
+ * is trained anew. The node returned by the previous call must not be used
+ * afterwards unless it is returned again.
  */
 int PSP_Build_Partition_MCSVM(PSP_Handle handle,
                               PSP_MCSVM* node);
 
+/**
+ * Builds a partition predicting the majority pattern of the `k` (at most 64)
+ * nearest samples of the sampled regions, ties going to the pattern of the
+ * nearest one. Must be called only after using `PSP_Get_Regions`.
+ *
+ * The samples are stored in a static k-d tree, as one array of coordinates
+ * and one of patterns, and distances are measured after mapping the search
+ * bounds to [-1, 1]. If `max_per_region` is positive, regions with more
+ * samples are represented by that many evenly spaced ones. The partition is
+ * used like a compiled one; it has no flat KdSVM layout, and its copies share
+ * the tree.
+ */
+int PSP_Build_Partition_KNN(PSP_Handle handle,
+                            int k,
+                            size_t max_per_region,
+                            PSP_Partition* partition);
+
+/**
+ * Compiles a KdSVM tree or an MCSVM node for prediction. The SVs and
+ * coefficients of every model are copied into flat arrays, so the partition
+ * stays valid after the tree or node is rebuilt or the handle is closed.
+ * Predicting does not allocate memory, but uses scratch space in the
+ * partition: each thread needs its own partition, see `PSP_Copy_Partition`.
+ */
+int PSP_Compile_KdSVM(PSP_KdSVMTree tree,
+                      PSP_Partition* partition);
+int PSP_Compile_MCSVM(PSP_MCSVM node,
+                      PSP_Partition* partition);
+
+/**
+ * Gives the flat layout of a compiled KdSVM partition: its nodes stored
+ * breadth-first in one array, with the SVs, coefficients and monomial weights
+ * of all nodes packed in a single array of values. The layout points into the
+ * partition and stays valid until the partition is deallocated. Returns
+ * EINVAL for other partitions.
+ */
+int PSP_Get_Flat_KdSVM(PSP_Partition partition,
+                       PSP_Flat_KdSVMRec* flat);
+
+/**
+ * Writes a C source file with a function
+ * `size_t psp_partition_predict(const double* x)` giving the data pattern of
+ * the region of a point like `PSP_Predict`, with the SVs, coefficients and
+ * standardization of every model as constants and the kernel specialized. A
+ * KdSVM becomes nested branches. The file only needs the C standard library.
+ * Returns EINVAL for nearest-neighbour partitions, and the errno of the
+ * failure if the file cannot be written.
+ */
+int PSP_Export_C(PSP_Partition partition,
+                 const char* path);
+
+/**
+ * Saves a compiled partition, e.g. of a whole KdSVM tree, to a binary file:
+ * the tree, the SVs, coefficients and other arrays of every model, aligned
+ * as in memory, and the flat layout. The file can only be loaded on a
+ * platform with the same byte order and type sizes. Returns EINVAL for
+ * nearest-neighbour partitions, and the errno of the failure if the file
+ * cannot be written.
+ */
+int PSP_Save_Partition(PSP_Partition partition,
+                       const char* path);
+
+/**
+ * Maps a file written by `PSP_Save_Partition` into memory and predicts from
+ * it in place: only the scratch space of the models is allocated, so loading
+ * takes little time, and processes mapping the same file share its pages.
+ * The file must not be modified while the partition or a copy of it is in
+ * use. Returns EINVAL if the file is not a valid partition file, and the
+ * errno of the failure if it cannot be mapped.
+ */
+int PSP_Load_Partition(const char* path,
+                       PSP_Partition* partition);
+
+/** Copies a compiled partition, e.g. for use by another thread. */
+int PSP_Copy_Partition(PSP_Partition partition,
+                       PSP_Partition* copy);
+
+/**
+ * Enables or disables exact fast prediction in `PSP_Predict`. When enabled,
+ * an MCSVM stops voting once no other pattern can win and only computes the
+ * kernel values of the patterns it compares; a KdSVM node stops summing once
+ * the remaining SVs cannot change the side of the point. The patterns found
+ * are the same.
+ */
+int PSP_Set_Fast_Predict(PSP_Partition partition,
+                         int enable);
+
+/** Finds the data pattern of the region containing the given point. */
+size_t PSP_Predict(PSP_Partition partition,
+                   const struct svm_node* x);
+
+/**
+ * Finds the data patterns of `num_points` points, given one after the other in
+ * 16-bit fixed point format like in `PSP_Get_Regions`, on up to
+ * `num_threads` threads (0 for one per hardware thread), see
+ * `PSP_Set_Partition_Executor`.
+ *
+ * The points are processed in blocks. For an MCSVM, the kernel values of a
+ * block are computed as one matrix product with the SVs; for a KdSVM, the
+ * flat layout is traversed one level at a time, the points of a block
+ * reaching a node being evaluated together; nearest-neighbour partitions
+ * are searched point by point. Decision values close to zero may be rounded
+ * differently than by `PSP_Predict`.
+ */
+int PSP_Predict_Batch(PSP_Partition partition,
+                      size_t num_points,
+                      const Fixed* points,
+                      size_t* patterns_out,
+                      int num_threads);
+
+/** Deallocates a compiled partition */
+void PSP_Free_Partition(PSP_Partition partition);
+
+/**
+ * Frees the KdSVM trees and MCSVM nodes built from the handle, which are
+ * otherwise freed by `PSP_Close`. The next builds then start anew.
+ */
+void PSP_Free_Models(PSP_Handle handle);
+
+/**
+ * Builds a lookup grid answering which region of a compiled partition a point
+ * is in, for points in the box [`xMin`, `xMax`]. The box is split into 2^dim
+ * cells recursively: a cell whose corners and `num_samples` random points are
+ * all predicted the same pattern is uniform and is not split further, the
+ * others are split down to `max_depth` (at most 16) levels. The partition is
+ * copied into the grid, which stays valid after it is deallocated.
+ *
+ * A cell is found uniform from samples only, so that a small region inside
+ * a cell, or a boundary that does not cross the samples, may be missed.
+ */
+int PSP_Build_Lookup_Grid(PSP_Partition partition,
+                          int max_depth,
+                          const Fixed* xMin,
+                          const Fixed* xMax,
+                          int num_samples,
+                          PSP_Lookup_Grid* grid);
+
+/**
+ * Finds the data pattern of the region containing a point in 16-bit fixed
+ * point format. In uniform cells this takes a few integer operations per
+ * level; in mixed cells and outside the grid, the partition is evaluated. Like
+ * a partition, a grid must not be used by several threads at once.
+ */
+size_t PSP_Lookup(PSP_Lookup_Grid grid,
+                  const Fixed* point);
+
+/** Deallocates a lookup grid */
+void PSP_Free_Lookup_Grid(PSP_Lookup_Grid grid);
+
+/**
+ * Makes the handle answer model queries with `PSP_Query_Surrogate`, from a
+ * copy of the given partition when the point is clearly inside a region, and
+ * from the sampling callback otherwise.
+ *
+ * A point is clearly inside its region when the margin of the partition is
+ * larger than `min_margin`: the smallest absolute decision value along the
+ * path of a KdSVM, the smallest decision value of the winning pattern against
+ * the others for an MCSVM, or the fraction of the neighbours voting for the
+ * winning pattern for a nearest-neighbour partition. Answers are cached by
+ * point; the cache is emptied when it reaches `max_cache` entries, 0 for no
+ * limit. Configuring again resets the cache and the counters.
+ */
+int PSP_Configure_Surrogate(PSP_Handle handle,
+                            PSP_Partition partition,
+                            PSP_Sampling_Callback sampling_callback,
+                            double min_margin,
+                            size_t max_cache);
+
+/**
+ * Finds the data pattern of a point in 16-bit fixed point format like the
+ * sampling callback would, see `PSP_Configure_Surrogate`. The confidence is
+ * the margin of the partition, or infinity when the callback was called.
+ */
+int PSP_Query_Surrogate(PSP_Handle handle,
+                        const Fixed* point,
+                        size_t* pattern,
+                        double* confidence);
+
+/** Gives the counters of the queries answered by `PSP_Query_Surrogate`. */
+int PSP_Get_Surrogate_Stats(PSP_Handle handle,
+                            PSP_Surrogate_Stats stats);
+
+/**
+ * Runs the parallel stages of the following calls on the handle, the tuning of
+ * SVM parameters, the training of the pairs of classes of an SVM, of the
+ * subtrees of a KdSVM partition and of the cross validation of probability
+ * estimates, as tasks given to `submit`, e.g. to run them on a pool of the
+ * application, or on a pool of the library if `submit` is NULL, the default.
+ * `submit` is called from any thread and must run each task once, on any
+ * thread, now or later; a task may also be run before `submit` returns. The
+ * thread calling the library takes part in the work and only waits for the
+ * tasks that started, so that the tasks may wait behind it in the queue of a
+ * pool. Partitions built from the handle do not inherit the executor. A sample
+ * sink is then called from the thread of the search, as it would take a task
+ * for the whole search.
+ */
+int PSP_Set_Executor(PSP_Handle handle,
+                     PSP_Submit_Func submit,
+                     void* executor_context);
+
+/**
+ * Runs the parallel stages of `PSP_Predict_Batch` on the partition with
+ * `submit`, as for `PSP_Set_Executor`. Copies of the partition share its
+ * executor.
+ */
+int PSP_Set_Partition_Executor(PSP_Partition partition,
+                               PSP_Submit_Func submit,
+                               void* executor_context);
+
+/**
+ * Starts a pool of `num_threads` threads running jobs, or one per hardware
+ * thread if 0. Returns NULL if the threads cannot be started.
+ */
+PSP_Job_Pool PSP_New_Job_Pool(size_t num_threads);
+
+/**
+ * Waits for the submitted jobs to be run and stops the pool. The jobs not
+ * waited for are freed and can no longer be waited for.
+ */
+void PSP_Close_Job_Pool(PSP_Job_Pool pool);
+
+/**
+ * Queues `run(handle, job_context)` to be run by the pool and stores in `job`
+ * a reference to wait for it with. The jobs of a handle are run one at a
+ * time, in the order they were submitted, and the pool serves the handles
+ * with queued jobs in turn, so that many jobs on one handle do not hold back
+ * the other handles. The handle must not be used outside the pool until its
+ * jobs are done.
+ *
+ * The parallel stages of a job, such as batch predictions or the tuning of
+ * SVM parameters, run on the thread of the job, so that the pool bounds the
+ * number of threads of all its jobs.
+ */
+int PSP_Submit_Job(PSP_Job_Pool pool,
+                   PSP_Handle handle,
+                   PSP_Job_Func run,
+                   void* job_context,
+                   PSP_Job* job);
+
+/**
+ * Waits for a job of the pool to be done, stores the value returned by its
+ * function in `result` if not NULL and frees the job. Returns EINVAL if it
+ * is not a job of the pool that has not been waited for.
+ */
+int PSP_Wait_Job(PSP_Job_Pool pool,
+                 PSP_Job job,
+                 int* result);
+
 /* for debug purposes */
 /**
  * Outputs points to stdout in the following format:
@@ -142,6 +617,15 @@ int PSP_Build_Partition_MCSVM(PSP_Handle handle,
  */
 void psp_dump_points(PSP_Handle handle);
 
+/**
+ * Outputs the statistics given by `PSP_Get_KdSVM_Stats` to stdout, one line
+ * per inner node in depth-first order:
+ *
+ * <depth> <no. of SVs> <iterations> <seconds> <final eps> <status>
+ *     <SVs before reduction> <agreement> <speedup>
+ */
+void psp_dump_solver_stats(PSP_KdSVMTree tree);
+
 #ifdef __cplusplus
 }
 #endif
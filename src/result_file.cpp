@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "debug.h"
+#include "mapped_file.h"
+#include "result_file.h"
+
+/*
+ * A result file is a header followed by one array per field of the regions,
+ * each starting at a multiple of `FILE_ALIGN` bytes: the patterns, the
+ * numbers of samples, the means, the covariance matrices, the search bounds,
+ * then the samples of all regions one after the other. Points are stored as
+ * consecutive doubles, matrices column by column, so that the arrays can be
+ * used in place from a mapped file. The byte order of the platform that
+ * wrote the file is recorded, and files of another platform are rejected.
+ */
+
+static const char FILE_MAGIC[8] = { 'P', 'S', 'P', 'R', 'S', 'L', 'T', '\0' };
+static const uint32_t FILE_VERSION = 1;
+static const uint32_t FILE_BYTE_ORDER = 0x01020304;
+static const size_t FILE_ALIGN = 64;
+
+struct Result_File_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;              // of the whole file
+
+    uint64_t dim;
+    uint64_t num_regions;
+    uint64_t num_samples;       // of all regions
+    uint64_t patterns;          // uint64_t[num_regions]
+    uint64_t counts;            // uint64_t[num_regions], samples of each region
+    uint64_t means;             // double[num_regions][dim]
+    uint64_t covariances;       // double[num_regions][dim][dim]
+    uint64_t x_min;             // double[dim], 0 if the bounds are not set
+    uint64_t x_max;             // double[dim]
+    uint64_t samples;           // double[num_samples][dim], region by region
+};
+
+/**
+ * Writes the arrays of a file one after the other, padding each one to its
+ * offset.
+ */
+struct File_Writer {
+    std::ofstream file;
+    uint64_t offset = 0;
+
+    void pad(uint64_t to)
+    {
+        static const char padding[FILE_ALIGN] = {};
+        file.write(padding, to - offset);
+        offset = to;
+    }
+
+    void write(void const* data, size_t size)
+    {
+        file.write(static_cast<char const*>(data), size);
+        offset += size;
+    }
+};
+
+void export_result(PSP_Result const& result,
+                   size_t dim,
+                   const char* path)
+{
+    uint64_t n = result.patterns.size();
+    if (result.xs.size() != n || result.xMean.size() != n || result.xCovMat.size() != n)
+        throw std::invalid_argument("inconsistent regions");
+
+    uint64_t num_samples = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        bool consistent = (uint64_t)result.xMean[i].size() == dim &&
+                          (uint64_t)result.xCovMat[i].rows() == dim &&
+                          (uint64_t)result.xCovMat[i].cols() == dim;
+        consistent = consistent && (result.xs[i].empty() || (uint64_t)result.xs[i].dim() == dim);
+        if (!consistent)
+            throw std::invalid_argument("inconsistent regions");
+        num_samples += result.xs[i].size();
+    }
+
+    Result_File_Header header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.byte_order = FILE_BYTE_ORDER;
+    header.dim = dim;
+    header.num_regions = n;
+    header.num_samples = num_samples;
+
+    uint64_t end = sizeof(header);
+    auto place = [&end](uint64_t size) {
+        uint64_t offset = (end + FILE_ALIGN - 1) / FILE_ALIGN * FILE_ALIGN;
+        end = offset + size;
+        return offset;
+    };
+    bool bounded = (uint64_t)result.xMin.size() == dim && (uint64_t)result.xMax.size() == dim;
+    header.patterns = place(n * sizeof(uint64_t));
+    header.counts = place(n * sizeof(uint64_t));
+    header.means = place(n * dim * sizeof(double));
+    header.covariances = place(n * dim * dim * sizeof(double));
+    header.x_min = bounded ? place(dim * sizeof(double)) : 0;
+    header.x_max = bounded ? place(dim * sizeof(double)) : 0;
+    header.samples = place(num_samples * dim * sizeof(double));
+    header.size = end;
+
+    File_Writer out;
+    out.file.open(path, std::ios::binary);
+    if (!out.file)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    // the points and matrices are written from where they are stored
+    out.write(&header, sizeof(header));
+    out.pad(header.patterns);
+    for (Pattern pattern : result.patterns) {
+        uint64_t value = pattern;
+        out.write(&value, sizeof(value));
+    }
+    out.pad(header.counts);
+    for (auto const& xs : result.xs) {
+        uint64_t count = xs.size();
+        out.write(&count, sizeof(count));
+    }
+    out.pad(header.means);
+    for (auto const& mean : result.xMean) {
+        out.write(mean.data(), dim * sizeof(double));
+    }
+    out.pad(header.covariances);
+    for (auto const& cov : result.xCovMat) {
+        out.write(cov.data(), dim * dim * sizeof(double));
+    }
+    if (bounded) {
+        out.pad(header.x_min);
+        out.write(result.xMin.data(), dim * sizeof(double));
+        out.pad(header.x_max);
+        out.write(result.xMax.data(), dim * sizeof(double));
+    }
+    out.pad(header.samples);
+    for (auto const& xs : result.xs) {
+        xs.for_each_block([&out, dim](double const* rows, size_t count) {
+            out.write(rows, count * dim * sizeof(double));
+        });
+    }
+
+    out.file.close();
+    if (!out.file)
+        throw std::system_error(errno ? errno : EIO, std::generic_category(), path);
+
+    DEBUG_LOG("Exported " << n << " regions and " << num_samples << " samples to "
+              << path << " (" << header.size << " bytes)\n");
+}
+
+PSP_Result import_result(const char* path,
+                         size_t dim,
+                         std::shared_ptr<const Sample_Storage> storage)
+{
+    Mapped_File file = map_file(path, "result file", sizeof(Result_File_Header));
+
+    Result_File_Header const& header = *file.array<Result_File_Header>(0, 1);
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+        throw std::invalid_argument("not a result file");
+    if (header.version != FILE_VERSION)
+        throw std::invalid_argument("unsupported result file version");
+    if (header.byte_order != FILE_BYTE_ORDER)
+        throw std::invalid_argument("result file written on another platform");
+    if (header.size != file.size)
+        throw std::invalid_argument("corrupt result file");
+    if (header.dim != dim)
+        throw std::invalid_argument("result file of another dimension");
+
+    // the counts are checked to fit in the file before their products with
+    // the dimension, which then cannot overflow
+    uint64_t n = header.num_regions;
+    auto patterns = file.array<uint64_t>(header.patterns, n);
+    auto counts = file.array<uint64_t>(header.counts, n);
+    auto means = file.array<double>(header.means, n * dim);
+    auto covariances = file.array<double>(header.covariances, n * dim * dim);
+    auto x_min = file.optional_array<double>(header.x_min, dim);
+    auto x_max = file.optional_array<double>(header.x_max, dim);
+    if (!x_min != !x_max)
+        throw std::invalid_argument("corrupt result file");
+
+    uint64_t num_samples = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (counts[i] > header.num_samples - num_samples)
+            throw std::invalid_argument("corrupt result file");
+        num_samples += counts[i];
+    }
+    file.array<double>(header.samples, num_samples);
+    auto samples = file.array<double>(header.samples, num_samples * dim);
+
+    PSP_Result result;
+    if (x_min) {
+        result.xMin = Eigen::Map<const Eigen::VectorXd>(x_min, dim);
+        result.xMax = Eigen::Map<const Eigen::VectorXd>(x_max, dim);
+    }
+    storage = bound_storage(storage, result.xMin, result.xMax);
+
+    result.patterns.assign(patterns, patterns + n);
+    result.xs.reserve(n);
+    result.xMean.reserve(n);
+    result.xCovMat.reserve(n);
+    for (uint64_t i = 0; i < n; i++) {
+        result.xMean.push_back(Eigen::Map<const Eigen::VectorXd>(means + i * dim, dim));
+        result.xCovMat.push_back(
+            Eigen::Map<const Eigen::MatrixXd>(covariances + i * dim * dim, dim, dim));
+
+        result.xs.emplace_back(dim, storage);
+        result.xs.back().append(samples, counts[i]);
+        samples += counts[i] * dim;
+    }
+
+    DEBUG_LOG("Imported " << n << " regions and " << num_samples << " samples from "
+              << path << "\n");
+
+    return result;
+}
+
+/* EOF */
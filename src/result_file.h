@@ -0,0 +1,29 @@
+#ifndef RESULT_FILE_H
+#define RESULT_FILE_H
+
+#include "psp_mcmc.h"
+
+#ifdef __cplusplus
+#include <system_error>
+
+/**
+ * Writes the regions found by a search in `dim` dimensions to a binary file,
+ * see `PSP_Export_Result`. Throws std::invalid_argument if the regions are
+ * inconsistent and std::system_error if the file cannot be written.
+ */
+void export_result(PSP_Result const& result, size_t dim, const char* path);
+
+/**
+ * Reads a file written by `export_result`, keeping the samples in `storage`.
+ * Throws std::invalid_argument if it is not a valid result file of this
+ * version and platform, or not of dimension `dim`, and std::system_error if
+ * it cannot be mapped.
+ */
+PSP_Result import_result(const char* path, size_t dim,
+                         std::shared_ptr<const Sample_Storage> storage = nullptr);
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,147 @@
+#include <chrono>
+
+#include "sample_sink.h"
+
+// samples of a region sent to the sink at once
+static const size_t SINK_BATCH_POINTS = 256;
+// batches waiting for the sink before the search waits
+static const size_t SINK_QUEUE_BATCHES = 64;
+
+/**
+ * Waits for the other thread: yields a few times, then sleeps, so that an
+ * idle thread does not take a core.
+ */
+static inline
+void backoff(int& spins)
+{
+    if (spins < 64) {
+        spins++;
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+Sample_Stream::Sample_Stream(PSP_Sample_SinkRec sink,
+                             size_t dim,
+                             bool threaded)
+: sink(sink), dim(dim),
+  full(SINK_QUEUE_BATCHES), empty(SINK_QUEUE_BATCHES),
+  done(false)
+{
+    if (threaded) {
+        consumer = std::thread(&Sample_Stream::run, this);
+    }
+}
+
+Sample_Stream::~Sample_Stream()
+{
+    finish();
+
+    Sample_Batch* batch;
+    while (empty.try_pop(batch)) {
+        delete batch;
+    }
+}
+
+Sample_Batch* Sample_Stream::take_batch()
+{
+    Sample_Batch* batch;
+    if (empty.try_pop(batch))
+        return batch;
+    batch = new Sample_Batch;
+    batch->points.reserve(SINK_BATCH_POINTS * dim);
+    return batch;
+}
+
+void Sample_Stream::push(size_t region,
+                         Pattern pattern,
+                         Point const& x)
+{
+    if (region >= current.size()) {
+        current.resize(region + 1, NULL);
+    }
+    Sample_Batch*& batch = current[region];
+    if (!batch) {
+        batch = take_batch();
+        batch->region = region;
+        batch->pattern = pattern;
+        batch->points.clear();
+    }
+
+    batch->points.insert(batch->points.end(), x.data(), x.data() + dim);
+
+    if (batch->points.size() == SINK_BATCH_POINTS * dim) {
+        send(batch);
+        batch = NULL;
+    }
+}
+
+/** Gives a full batch to the sink thread, or to the sink if there is none */
+void Sample_Stream::send(Sample_Batch* batch)
+{
+    if (!consumer.joinable()) {
+        consume(batch);
+        return;
+    }
+    for (int spins = 0; !full.try_push(batch); ) {
+        backoff(spins);
+    }
+}
+
+void Sample_Stream::finish()
+{
+    for (Sample_Batch*& batch : current) {
+        if (!batch)
+            continue;
+        send(batch);
+        batch = NULL;
+    }
+
+    if (!consumer.joinable())
+        return;
+    done.store(true, std::memory_order_release);
+    consumer.join();
+}
+
+/** Gives a batch to the sink and keeps it to be reused */
+void Sample_Stream::consume(Sample_Batch* batch)
+{
+    size_t num_points = batch->points.size() / dim;
+    if (sink.consume_double) {
+        sink.consume_double(sink.sink_context, batch->region, batch->pattern,
+                            num_points, batch->points.data());
+    } else {
+        // same rounding as the coordinates given to the sampling callback
+        rounded.resize(batch->points.size());
+        for (size_t j = 0; j < batch->points.size(); j++) {
+            rounded[j] = unmap_coord(batch->points[j]);
+        }
+        sink.consume(sink.sink_context, batch->region, batch->pattern,
+                     num_points, rounded.data());
+    }
+    if (!empty.try_push(batch)) {
+        delete batch;
+    }
+}
+
+void Sample_Stream::run()
+{
+    int spins = 0;
+    for (;;) {
+        Sample_Batch* batch;
+        if (!full.try_pop(batch)) {
+            if (!done.load(std::memory_order_acquire)) {
+                backoff(spins);
+                continue;
+            }
+            // batches pushed before `done` are seen after it
+            if (!full.try_pop(batch))
+                return;
+        }
+        spins = 0;
+        consume(batch);
+    }
+}
+
+/* EOF */
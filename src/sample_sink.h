@@ -0,0 +1,147 @@
+#ifndef SAMPLE_SINK_H
+#define SAMPLE_SINK_H
+
+#include <stddef.h>
+#include "common.h"
+
+#ifdef __cplusplus
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "psp_mcmc.h"
+
+
+extern "C"
+{
+#endif
+
+/**
+ * Receives `num_points` samples accepted in the region of index `region` of
+ * a search, whose data pattern is `pattern`, given one after the other in
+ * 16-bit fixed point format, rounded down as for the sampling callback of
+ * `PSP_Get_Regions`.
+ */
+typedef void (*Sample_Sink_Func)(void* sink_context,
+                                 size_t region,
+                                 size_t pattern,
+                                 size_t num_points,
+                                 const Fixed* points);
+
+/**
+ * Same as `Sample_Sink_Func`, but gives the coordinates as searched, e.g. as
+ * given to the sampling callback of `PSP_Get_Regions_Double`.
+ */
+typedef void (*Sample_Sink_Double_Func)(void* sink_context,
+                                        size_t region,
+                                        size_t pattern,
+                                        size_t num_points,
+                                        const double* points);
+
+/**
+ * A sink of samples: `consume_double` is called if set, `consume` otherwise.
+ */
+typedef struct PSP_Sample_SinkRec_ {
+    void* sink_context;
+    Sample_Sink_Func consume;
+    Sample_Sink_Double_Func consume_double;
+} PSP_Sample_SinkRec, *PSP_Sample_Sink;
+
+#ifdef __cplusplus
+}
+
+
+/**
+ * A bounded single-producer single-consumer queue. Pushing and popping never
+ * block and use no lock: they fail when the queue is full or empty.
+ */
+template <typename T>
+class SPSC_Queue {
+public:
+    // the capacity is rounded up to a power of two
+    explicit SPSC_Queue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool try_push(T const& value)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) > mask)
+            return false;
+        slots[tail & mask] = value;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[head & mask];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // indices of the next slots to pop and to push, on their own cache lines
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+struct Sample_Batch {
+    size_t region;
+    Pattern pattern;
+    std::vector<double> points;
+};
+
+/**
+ * Streams the samples of a search to a sink on a thread of its own. The
+ * samples of each region are gathered into batches, which go to the sink
+ * thread through a bounded lock-free queue and come back through another
+ * one to be reused. The search waits when the sink falls too far behind.
+ * Unless `threaded`, the batches are given to the sink from the thread of
+ * the search as they fill, and no thread is started.
+ */
+class Sample_Stream {
+public:
+    Sample_Stream(PSP_Sample_SinkRec sink, size_t dim, bool threaded = true);
+    Sample_Stream(Sample_Stream const& other) = delete;
+    Sample_Stream & operator=(Sample_Stream const& other) = delete;
+    ~Sample_Stream();
+
+    void push(size_t region, Pattern pattern, Point const& x);
+    /** Sends the partial batches and waits until the sink received them */
+    void finish();
+
+private:
+    Sample_Batch* take_batch();
+    void send(Sample_Batch* batch);
+    void consume(Sample_Batch* batch);
+    void run();
+
+    PSP_Sample_SinkRec sink;
+    size_t dim;
+    // batch being filled for each region
+    std::vector<Sample_Batch*> current;
+    SPSC_Queue<Sample_Batch*> full;
+    SPSC_Queue<Sample_Batch*> empty;
+    // points of a batch rounded for `sink.consume`, by the thread calling it
+    std::vector<Fixed> rounded;
+    std::atomic<bool> done;
+    std::thread consumer;
+};
+
+#endif
+
+#endif
+
+/* EOF */
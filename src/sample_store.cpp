@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "psp_mcmc.h"
+
+std::shared_ptr<const Sample_Storage>
+bound_storage(std::shared_ptr<const Sample_Storage> storage,
+              Eigen::VectorXd const& xMin,
+              Eigen::VectorXd const& xMax)
+{
+    if (!storage || storage->encoding == PSP_SAMPLE_DOUBLE)
+        return storage;
+
+    auto bound = std::make_shared<Sample_Storage>(*storage);
+    size_t dim = xMin.size();
+    if (dim == 0 || (size_t)xMax.size() != dim) {
+        bound->encoding = PSP_SAMPLE_DOUBLE;
+        return bound;
+    }
+
+    // the bounds are split into as many steps as the encoding has values,
+    // which are single fixed point units unless the bounds are too far apart
+    uint64_t levels = storage->encoding == PSP_SAMPLE_FIXED16
+                    ? std::numeric_limits<uint16_t>::max()
+                    : std::numeric_limits<uint32_t>::max();
+    bound->base.resize(dim);
+    bound->step.resize(dim);
+    for (size_t k = 0; k < dim; k++) {
+        Fixed lo = unmap_coord(xMin[k]);
+        Fixed hi = unmap_coord(xMax[k]);
+        uint64_t span = hi > lo ? hi - lo : 0;
+        bound->base[k] = lo;
+        bound->step[k] = span > levels ? (span + levels - 1) / levels : 1;
+    }
+
+    bound->offset.clear();
+    bound->scale.clear();
+    for (size_t r = 0; r < SAMPLE_DECODE_ROWS; r++) {
+        for (size_t k = 0; k < dim; k++) {
+            bound->offset.push_back(map_coord(bound->base[k]));
+            bound->scale.push_back(map_coord(bound->step[k]));
+        }
+    }
+
+    return bound;
+}
+
+static inline
+bool same_encoding(Sample_Storage const* a,
+                   Sample_Storage const* b)
+{
+    PSP_Sample_Encoding encoding_a = a ? a->encoding : PSP_SAMPLE_DOUBLE;
+    PSP_Sample_Encoding encoding_b = b ? b->encoding : PSP_SAMPLE_DOUBLE;
+    if (encoding_a != encoding_b)
+        return false;
+    return encoding_a == PSP_SAMPLE_DOUBLE || (a->base == b->base && a->step == b->step);
+}
+
+/**
+ * Rounds coordinates to fixed point, as given to the sampling callback, and
+ * stores them relative to the bounds of the storage.
+ */
+template <typename Q>
+static inline
+void encode_rows(double const* x,
+                 size_t n,
+                 Sample_Storage const& storage,
+                 Q* q)
+{
+    size_t dim = storage.base.size();
+    for (size_t j = 0; j < n; j++) {
+        Fixed d = unmap_coord(x[j]) - storage.base[j % dim];
+        uint64_t value = d > 0 ? (uint64_t)d / storage.step[j % dim] : 0;
+        q[j] = (Q)std::min<uint64_t>(value, std::numeric_limits<Q>::max());
+    }
+}
+
+/**
+ * Decodes `n` quantized coordinates. The offsets and scales are given for
+ * each coordinate so that the loop has no index arithmetic and vectorizes.
+ */
+template <typename Q>
+static inline
+void decode_rows(Q const* q,
+                 size_t n,
+                 double const* offset,
+                 double const* scale,
+                 double* x)
+{
+    for (size_t j = 0; j < n; j++) {
+        x[j] = offset[j] + q[j] * scale[j];
+    }
+}
+
+Sample_Store::Sample_Store(size_t dim,
+                           std::shared_ptr<const Sample_Storage> storage)
+: n_dim(dim), storage(storage), num_spilled(0)
+{ }
+
+size_t Sample_Store::row_bytes(Sample_Storage const* storage) const
+{
+    switch (storage ? storage->encoding : PSP_SAMPLE_DOUBLE) {
+    case PSP_SAMPLE_FIXED32:
+        return n_dim * sizeof(uint32_t);
+    case PSP_SAMPLE_FIXED16:
+        return n_dim * sizeof(uint16_t);
+    default:
+        return n_dim * sizeof(double);
+    }
+}
+
+void Sample_Store::decode(Sample_Storage const* storage,
+                          char const* data,
+                          size_t count,
+                          double* rows) const
+{
+    size_t n = count * n_dim;
+    switch (storage ? storage->encoding : PSP_SAMPLE_DOUBLE) {
+    case PSP_SAMPLE_FIXED32:
+        decode_rows(reinterpret_cast<uint32_t const*>(data), n,
+                    storage->offset.data(), storage->scale.data(), rows);
+        break;
+    case PSP_SAMPLE_FIXED16:
+        decode_rows(reinterpret_cast<uint16_t const*>(data), n,
+                    storage->offset.data(), storage->scale.data(), rows);
+        break;
+    default:
+        memcpy(rows, data, n * sizeof(double));
+        break;
+    }
+}
+
+Eigen::VectorXd Sample_Store::operator[](size_t i) const
+{
+    Eigen::VectorXd x(n_dim);
+    if (i >= num_spilled) {
+        decode(storage.get(), tail.data() + (i - num_spilled) * row_bytes(storage.get()), 1, x.data());
+        return x;
+    }
+
+    size_t s = std::upper_bound(segment_start.begin(), segment_start.end(), i)
+             - segment_start.begin() - 1;
+    Segment const& segment = segments[s];
+    decode(segment.storage.get(),
+           segment.data + (i - segment_start[s]) * row_bytes(segment.storage.get()), 1, x.data());
+    return x;
+}
+
+void Sample_Store::push_back(Eigen::VectorXd const& x)
+{
+    append(x.data(), 1);
+}
+
+void Sample_Store::append(double const* rows,
+                          size_t count)
+{
+    size_t start = tail.size();
+    tail.resize(start + count * row_bytes(storage.get()));
+    char* data = tail.data() + start;
+
+    switch (storage ? storage->encoding : PSP_SAMPLE_DOUBLE) {
+    case PSP_SAMPLE_FIXED32:
+        encode_rows(rows, count * n_dim, *storage, reinterpret_cast<uint32_t*>(data));
+        break;
+    case PSP_SAMPLE_FIXED16:
+        encode_rows(rows, count * n_dim, *storage, reinterpret_cast<uint16_t*>(data));
+        break;
+    default:
+        memcpy(data, rows, count * n_dim * sizeof(double));
+        break;
+    }
+
+    if (storage && !storage->spill_dir.empty() && tail.size() > storage->tail_bytes) {
+        spill();
+    }
+}
+
+void Sample_Store::append(Sample_Store const& other)
+{
+    if (n_dim == 0) {
+        n_dim = other.n_dim;
+        storage = other.storage;
+    }
+    bool same = same_encoding(storage.get(), other.storage.get());
+    if (other.segments.empty() && same) {
+        tail.insert(tail.end(), other.tail.begin(), other.tail.end());
+        if (storage && !storage->spill_dir.empty() && tail.size() > storage->tail_bytes) {
+            spill();
+        }
+        return;
+    }
+
+    // the samples in memory go before those of the other store
+    seal();
+    for (auto const& segment : other.segments) {
+        segment_start.push_back(num_spilled);
+        segments.push_back(segment);
+        num_spilled += segment.count;
+    }
+    if (same) {
+        tail = other.tail;
+    } else if (!other.tail.empty()) {
+        auto buffer = std::make_shared<std::vector<char>>(other.tail);
+        segment_start.push_back(num_spilled);
+        segments.push_back({ buffer, buffer->data(), buffer->size() / row_bytes(other.storage.get()),
+                             other.storage });
+        num_spilled += segments.back().count;
+    }
+}
+
+void Sample_Store::clear()
+{
+    segments.clear();
+    segment_start.clear();
+    num_spilled = 0;
+    tail.clear();
+}
+
+/**
+ * Moves the samples in memory to a new segment file, along with the last
+ * segments while they are not larger than the samples moved, so that the
+ * sizes of the segments at least double from the last one to the first.
+ */
+void Sample_Store::spill()
+{
+    size_t bytes = row_bytes(storage.get());
+    size_t count = tail.size() / bytes;
+    size_t first = segments.size();
+    while (first > 0 && segments[first - 1].count <= count &&
+           same_encoding(segments[first - 1].storage.get(), storage.get())) {
+        first--;
+        count += segments[first].count;
+    }
+
+    std::vector<Spill_Part> parts;
+    for (size_t s = first; s < segments.size(); s++) {
+        parts.push_back({ segments[s].data, segments[s].count * bytes });
+    }
+    parts.push_back({ tail.data(), tail.size() });
+    Mapped_File file = spill_file(storage->spill_dir.c_str(), parts.data(), parts.size());
+
+    if (first < segments.size()) {
+        num_spilled = segment_start[first];
+        segments.erase(segments.begin() + first, segments.end());
+        segment_start.erase(segment_start.begin() + first, segment_start.end());
+    }
+    segment_start.push_back(num_spilled);
+    segments.push_back({ file.mapping, file.data, count, storage });
+    num_spilled += count;
+    tail.clear();
+}
+
+/**
+ * Ends the samples in memory, moving them to a segment file or to a segment
+ * in memory, so that segments of another encoding can follow them.
+ */
+void Sample_Store::seal()
+{
+    if (tail.empty())
+        return;
+    if (storage && !storage->spill_dir.empty()) {
+        spill();
+        return;
+    }
+
+    auto buffer = std::make_shared<std::vector<char>>(std::move(tail));
+    segment_start.push_back(num_spilled);
+    segments.push_back({ buffer, buffer->data(), buffer->size() / row_bytes(storage.get()), storage });
+    num_spilled += segments.back().count;
+    tail = std::vector<char>();
+}
+
+/* EOF */
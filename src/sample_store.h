@@ -0,0 +1,152 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#ifdef __cplusplus
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// included by psp_mcmc.h, after Eigen is configured
+#include "common.h"
+#include "mapped_file.h"
+
+// samples decoded at once from a quantized encoding
+static const size_t SAMPLE_DECODE_ROWS = 256;
+// least bytes of samples of a region kept in memory before they are spilled
+static const size_t SAMPLE_MIN_TAIL_BYTES = 64 * 1024;
+
+/** Where and how the samples of a search are kept */
+struct Sample_Storage {
+    // directory of the segment files, empty to keep every sample in memory
+    std::string spill_dir;
+    // bytes of samples of a region kept in memory before they are moved to a
+    // segment file
+    size_t tail_bytes;
+
+    PSP_Sample_Encoding encoding;
+    // quantized encodings: a coordinate of fixed point value f is stored as
+    // (f - base) / step; it is decoded as offset + q * scale, the offsets and
+    // scales being repeated for SAMPLE_DECODE_ROWS samples
+    std::vector<Fixed> base;
+    std::vector<Fixed> step;
+    std::vector<double> offset;
+    std::vector<double> scale;
+};
+
+/**
+ * Returns the storage of the samples of a search within the given bounds:
+ * for a quantized encoding, a copy of `storage` with the coordinates relative
+ * to the bounds, or in doubles if the bounds are not set.
+ */
+std::shared_ptr<const Sample_Storage>
+bound_storage(std::shared_ptr<const Sample_Storage> storage,
+              Eigen::VectorXd const& xMin,
+              Eigen::VectorXd const& xMax);
+
+/**
+ * The samples of a region, in the order they were added. The latest ones are
+ * kept in memory; with a spill directory, they are moved to a new segment
+ * file whenever they exceed the memory budget. Segments are written once,
+ * unlinked and read through a read-only mapping, so that copies of a store
+ * share them and they disappear with the last store using them. As each
+ * segment takes a mapping, the last segments are merged into the new one
+ * while they are not larger than it, so that a store has a number of
+ * segments logarithmic in its samples.
+ *
+ * Samples are kept in the encoding of the storage, and decoded when read.
+ * Each segment keeps the storage it was encoded with, so that stores of
+ * searches with different bounds can be merged.
+ */
+class Sample_Store {
+public:
+    explicit Sample_Store(size_t dim = 0,
+                          std::shared_ptr<const Sample_Storage> storage = nullptr);
+
+    size_t dim() const { return n_dim; }
+    size_t size() const { return num_spilled + (tail.empty() ? 0 : tail.size() / row_bytes(storage.get())); }
+    bool empty() const { return size() == 0; }
+
+    Eigen::VectorXd operator[](size_t i) const;
+    Eigen::VectorXd back() const { return (*this)[size() - 1]; }
+
+    void push_back(Eigen::VectorXd const& x);
+    /** Adds `count` samples given one after the other */
+    void append(double const* rows, size_t count);
+    /** Adds the samples of another store, sharing its segments */
+    void append(Sample_Store const& other);
+    void clear();
+
+    /**
+     * Calls `f(rows, count)` for each block of consecutive samples, in order,
+     * the samples of a block being given one after the other.
+     */
+    template <typename F>
+    void for_each_block(F f) const
+    {
+        std::vector<double> buffer;
+        for (auto const& segment : segments) {
+            decode_blocks(segment.storage.get(), segment.data, segment.count, buffer, f);
+        }
+        if (!tail.empty()) {
+            decode_blocks(storage.get(), tail.data(), tail.size() / row_bytes(storage.get()), buffer, f);
+        }
+    }
+
+    /** Calls `f(x)` for each sample, in order */
+    template <typename F>
+    void for_each(F f) const
+    {
+        for_each_block([&](double const* rows, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                f(Eigen::Map<const Eigen::VectorXd>(rows + i * n_dim, n_dim));
+            }
+        });
+    }
+
+private:
+    struct Segment {
+        // keeps the samples mapped or allocated
+        std::shared_ptr<const void> owner;
+        char const* data;
+        size_t count;
+        std::shared_ptr<const Sample_Storage> storage;
+    };
+
+    size_t row_bytes(Sample_Storage const* storage) const;
+    void decode(Sample_Storage const* storage, char const* data, size_t count, double* rows) const;
+    void spill();
+    void seal();
+
+    /** Calls `f` on the samples in doubles, decoding them block by block */
+    template <typename F>
+    void decode_blocks(Sample_Storage const* storage, char const* data, size_t count,
+                       std::vector<double>& buffer, F& f) const
+    {
+        if (!storage || storage->encoding == PSP_SAMPLE_DOUBLE) {
+            f(reinterpret_cast<double const*>(data), count);
+            return;
+        }
+        buffer.resize(SAMPLE_DECODE_ROWS * n_dim);
+        for (size_t i = 0; i < count; i += SAMPLE_DECODE_ROWS) {
+            size_t rows = std::min(count - i, SAMPLE_DECODE_ROWS);
+            decode(storage, data + i * row_bytes(storage), rows, buffer.data());
+            f(static_cast<double const*>(buffer.data()), rows);
+        }
+    }
+
+    size_t n_dim;
+    std::shared_ptr<const Sample_Storage> storage;
+    std::vector<Segment> segments;
+    // first sample of each segment
+    std::vector<size_t> segment_start;
+    size_t num_spilled;
+    // encoded samples in memory
+    std::vector<char> tail;
+};
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,52 @@
+#include <cmath>
+
+#include "debug.h"
+#include "surrogate.h"
+
+Surrogate_Answer query_surrogate(Surrogate& surrogate,
+                                 Fixed const* point)
+{
+    size_t dim = surrogate.partition->dim;
+    std::vector<Fixed> key(point, point + dim);
+
+    surrogate.stats.queries++;
+    auto it = surrogate.cache.find(key);
+    if (it != surrogate.cache.end()) {
+        surrogate.stats.cache_hits++;
+        return it->second;
+    }
+
+    std::vector<double> values(dim);
+    for (size_t i = 0; i < dim; i++) {
+        values[i] = map_coord(point[i]);
+    }
+    svm_node x = { (int)dim, values.data() };
+
+    Surrogate_Answer answer;
+    answer.pattern = predict_partition_margin(surrogate.partition.get(), &x, &answer.confidence);
+
+    if (answer.confidence > surrogate.min_margin) {
+        surrogate.stats.partition_hits++;
+    } else {
+        // the callback may modify the point
+        std::vector<Fixed> copy(key);
+        size_t pattern = surrogate.model(copy.data());
+        surrogate.stats.model_calls++;
+        if (pattern != answer.pattern)
+            surrogate.stats.disagreements++;
+
+        answer.pattern = pattern;
+        answer.confidence = HUGE_VAL;
+    }
+
+    // the simplest bound on the memory used: start over when full
+    if (surrogate.max_cache > 0 && surrogate.cache.size() >= surrogate.max_cache) {
+        DEBUG_LOG("Surrogate: cache full, clearing it\n");
+        surrogate.cache.clear();
+    }
+    surrogate.cache.emplace(std::move(key), answer);
+
+    return answer;
+}
+
+/* EOF */
@@ -0,0 +1,66 @@
+#ifndef SURROGATE_H
+#define SURROGATE_H
+
+#include "common.h"
+#include "partition.h"
+
+#ifdef __cplusplus
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+
+extern "C"
+{
+#endif
+
+/** Counters of the queries answered by a surrogate */
+typedef struct PSP_Surrogate_StatsRec_ {
+    size_t queries;
+    size_t cache_hits;      /* queries answered from the cache */
+    size_t partition_hits;  /* queries answered by the partition */
+    size_t model_calls;     /* queries answered by the sampling callback */
+    size_t disagreements;   /* model calls where the partition was wrong */
+} PSP_Surrogate_StatsRec, *PSP_Surrogate_Stats;
+
+#ifdef __cplusplus
+}
+
+
+struct Fixed_Point_Hash {
+    size_t operator()(std::vector<Fixed> const& point) const
+    {
+        size_t seed = point.size();
+        for (Fixed x : point) {
+            seed ^= std::hash<Fixed>()(x) + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
+
+struct Surrogate_Answer {
+    size_t pattern;
+    double confidence;
+};
+
+/**
+ * Answers model queries from a partition when the point is clearly inside a
+ * region, and from the model otherwise, caching all answers.
+ */
+struct Surrogate {
+    std::unique_ptr<PSP_PartitionRec_> partition;
+    std::function<size_t(Fixed*)> model;
+    double min_margin;
+    size_t max_cache;
+    std::unordered_map<std::vector<Fixed>, Surrogate_Answer, Fixed_Point_Hash> cache;
+    PSP_Surrogate_StatsRec stats;
+};
+
+Surrogate_Answer query_surrogate(Surrogate& surrogate,
+                                 Fixed const* point);
+#endif
+
+#endif
+
+/* EOF */
@@ -40,8 +40,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <vector>
 #include "debug.h"
 #include "svm.h"
+#include "parallel.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
 typedef signed char schar;
@@ -77,7 +83,7 @@ static void print_string_stdout(const char *s)
 	fputs(s,stdout);
 	fflush(stdout);
 }
-static void (*svm_print_string) (const char *) = &print_string_stdout;
+static std::atomic<void (*)(const char *)> svm_print_string(&print_string_stdout);
 #if DEBUG
 static void info(const char *fmt,...)
 {
@@ -86,12 +92,17 @@ static void info(const char *fmt,...)
 	va_start(ap,fmt);
 	vsprintf(buf,fmt,ap);
 	va_end(ap);
-	(*svm_print_string)(buf);
+	(*svm_print_string.load())(buf);
 }
 #else
 static void info(const char *fmt,...) {}
 #endif
 
+static double wall_time()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 //
 // Kernel Cache
 //
@@ -482,6 +493,45 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 //
 // solution will be put in \alpha, objective value will be put in obj
 //
+// Limits of the solver runs of one training, and their statistics
+//
+// With eps_coarse > eps, the solver first stops at eps_coarse, then divides
+// the tolerance by 10 until eps is reached, unless the signs of the decision
+// values at the training points did not change from one stage to the next.
+//
+struct Solver_Budget
+{
+	int max_iter;		// per run, 0 for the default
+	double deadline;	// wall_time() at which to stop, 0 for none
+	double eps_coarse;	// first tolerance of the schedule, 0 for none
+	svm_solver_stats stats;
+};
+
+static void clear_stats(svm_solver_stats *stats)
+{
+	stats->iter = 0;
+	stats->time = 0;
+	stats->eps = 0;
+	stats->status = SOLVER_CONVERGED;
+}
+
+static Solver_Budget solver_budget(const svm_parameter *param)
+{
+	Solver_Budget budget;
+	budget.max_iter = param->max_iter;
+	budget.deadline = param->max_time > 0 ? wall_time() + param->max_time : 0;
+	budget.eps_coarse = param->eps_coarse;
+	clear_stats(&budget.stats);
+	return budget;
+}
+
+static void add_stats(svm_solver_stats *stats, const svm_solver_stats& run)
+{
+	stats->iter += run.iter;
+	stats->eps = max(stats->eps, run.eps);
+	stats->status = max(stats->status, run.status);
+}
+
 class Solver {
 public:
 	Solver() {};
@@ -497,7 +547,7 @@ public:
 
 	void Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking);
+		   SolutionInfo* si, int shrinking, Solver_Budget *budget = NULL);
 protected:
 	int active_size;
 	schar *y;
@@ -595,7 +645,7 @@ void Solver::reconstruct_gradient()
 
 void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking)
+		   SolutionInfo* si, int shrinking, Solver_Budget *budget)
 {
 	this->l = l;
 	this->Q = &Q;
@@ -608,6 +658,14 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	this->eps = eps;
 	unshrink = false;
 
+	// coarse-to-fine tolerance schedule
+	schar *pred = NULL;
+	if(budget && budget->eps_coarse > eps)
+	{
+		this->eps = budget->eps_coarse;
+		pred = new schar[l];
+	}
+
 	// initialize alpha_status
 	{
 		alpha_status = new char[l];
@@ -652,6 +710,11 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	int iter = 0;
 	int max_iter = max(10000000, l>INT_MAX/100 ? INT_MAX : 100*l);
 	int counter = min(l,1000)+1;
+	int status = SOLVER_CONVERGED;
+	bool have_pred = false;
+
+	if(budget && budget->max_iter > 0)
+		max_iter = budget->max_iter;
 
 	while(iter < max_iter)
 	{
@@ -662,6 +725,12 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			counter = min(l,1000);
 			if(shrinking) do_shrinking();
 			info(".");
+
+			if(budget && budget->deadline > 0 && wall_time() >= budget->deadline)
+			{
+				status = SOLVER_MAX_TIME;
+				break;
+			}
 		}
 
 		int i,j;
@@ -673,7 +742,33 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			active_size = l;
 			info("*");
 			if(select_working_set(i,j)!=0)
-				break;
+			{
+				if(this->eps <= eps)
+					break;
+
+				// compare the training predictions with the previous stage
+				double rho = calculate_rho();
+				bool changed = !have_pred;
+				for(int k=0;k<l;k++)
+				{
+					schar sign = y[k]*(G[k]-p[k]) - rho > 0 ? 1 : -1;
+					if(pred[active_set[k]] != sign)
+						changed = true;
+					pred[active_set[k]] = sign;
+				}
+				have_pred = true;
+				if(!changed)
+				{
+					info("\npredictions stable at eps = %g\n",this->eps);
+					status = SOLVER_STABLE;
+					break;
+				}
+
+				this->eps = max(this->eps/10, eps);
+				unshrink = false;
+				counter = 1;
+				continue;
+			}
 			else
 				counter = 1;	// do shrinking next iteration
 		}
@@ -820,7 +915,10 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		}
 	}
 
-	if(iter >= max_iter)
+	if(iter >= max_iter && status == SOLVER_CONVERGED)
+		status = SOLVER_MAX_ITER;
+
+	if(status == SOLVER_MAX_ITER || status == SOLVER_MAX_TIME)
 	{
 		if(active_size < l)
 		{
@@ -829,7 +927,20 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			active_size = l;
 			info("*");
 		}
-		fprintf(stderr,"\nWARNING: reaching max number of iterations\n");
+		if(status == SOLVER_MAX_ITER)
+			fprintf(stderr,"\nWARNING: reaching max number of iterations\n");
+		else
+			info("\nreaching the time limit\n");
+	}
+
+	if(budget)
+	{
+		svm_solver_stats run;
+		run.iter = iter;
+		run.time = 0;
+		run.eps = this->eps;
+		run.status = status;
+		add_stats(&budget->stats, run);
 	}
 
 	// calculate rho
@@ -865,6 +976,7 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 	info("\noptimization finished, #iter = %d\n",iter);
 
+	delete[] pred;
 	delete[] p;
 	delete[] y;
 	delete[] alpha;
@@ -1104,10 +1216,10 @@ public:
 	Solver_NU() {}
 	void Solve(int l, const QMatrix& Q, const double *p, const schar *y,
 		   double *alpha, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking)
+		   SolutionInfo* si, int shrinking, Solver_Budget *budget = NULL)
 	{
 		this->si = si;
-		Solver::Solve(l,Q,p,y,alpha,Cp,Cn,eps,si,shrinking);
+		Solver::Solve(l,Q,p,y,alpha,Cp,Cn,eps,si,shrinking,budget);
 	}
 private:
 	SolutionInfo *si;
@@ -1529,9 +1641,46 @@ private:
 //
 // construct and solve various formulations
 //
+
+// Turns the coefficients (alpha_i * y_i) of a previous solution into a
+// feasible starting point: the dual variables of class `side` are rescaled
+// to sum up to `target`, clipped to [0, upper], and any remaining deficit
+// is spread over the variables that are not at the upper bound.
+static void warm_start_side(
+	double *alpha, const double *alpha0, const schar *y, int l,
+	schar side, double target, double upper)
+{
+	int i;
+	double sum = 0;
+	for(i=0;i<l;i++)
+		if(y[i] == side)
+		{
+			alpha[i] = max(alpha0[i]*y[i], 0.0);
+			sum += alpha[i];
+		}
+
+	double scale = sum > 0 ? target/sum : 0;
+	double deficit = target;
+	for(i=0;i<l;i++)
+		if(y[i] == side)
+		{
+			alpha[i] = min(alpha[i]*scale, upper);
+			deficit -= alpha[i];
+		}
+
+	for(i=0;i<l && deficit > 0;i++)
+		if(y[i] == side && alpha[i] < upper)
+		{
+			double d = min(upper - alpha[i], deficit);
+			alpha[i] += d;
+			deficit -= d;
+		}
+}
+
 static void solve_c_svc(
 	const svm_problem *prob, const svm_parameter* param,
-	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn)
+	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn,
+	const double *alpha0, Solver_Budget *budget)
 {
 	int l = prob->l;
 	double *minus_ones = new double[l];
@@ -1546,9 +1695,23 @@ static void solve_c_svc(
 		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
 	}
 
+	if(alpha0)
+	{
+		// both classes must carry the same total weight
+		double sum_pos = 0, sum_neg = 0;
+		for(i=0;i<l;i++)
+			if(y[i] == +1)
+				sum_pos += min(max(alpha0[i], 0.0), Cp);
+			else
+				sum_neg += min(max(-alpha0[i], 0.0), Cn);
+		double target = min(sum_pos, sum_neg);
+		warm_start_side(alpha, alpha0, y, l, +1, target, Cp);
+		warm_start_side(alpha, alpha0, y, l, -1, target, Cn);
+	}
+
 	Solver s;
 	s.Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
-		alpha, Cp, Cn, param->eps, si, param->shrinking);
+		alpha, Cp, Cn, param->eps, si, param->shrinking, budget);
 
 	double sum_alpha=0;
 	for(i=0;i<l;i++)
@@ -1566,7 +1729,8 @@ static void solve_c_svc(
 
 static void solve_nu_svc(
 	const svm_problem *prob, const svm_parameter *param,
-	double *alpha, Solver::SolutionInfo* si)
+	double *alpha, Solver::SolutionInfo* si, const double *alpha0,
+	Solver_Budget *budget)
 {
 	int i;
 	int l = prob->l;
@@ -1583,6 +1747,12 @@ static void solve_nu_svc(
 	double sum_pos = nu*l/2;
 	double sum_neg = nu*l/2;
 
+	if(alpha0)
+	{
+		warm_start_side(alpha, alpha0, y, l, +1, sum_pos, 1.0);
+		warm_start_side(alpha, alpha0, y, l, -1, sum_neg, 1.0);
+	}
+	else
 	for(i=0;i<l;i++)
 		if(y[i] == +1)
 		{
@@ -1602,7 +1772,7 @@ static void solve_nu_svc(
 
 	Solver_NU s;
 	s.Solve(l, SVC_Q(*prob,*param,y), zeros, y,
-		alpha, 1.0, 1.0, param->eps, si,  param->shrinking);
+		alpha, 1.0, 1.0, param->eps, si,  param->shrinking, budget);
 	double r = si->r;
 
 	info("C = %f\n",1/r);
@@ -1621,7 +1791,7 @@ static void solve_nu_svc(
 
 static void solve_one_class(
 	const svm_problem *prob, const svm_parameter *param,
-	double *alpha, Solver::SolutionInfo* si)
+	double *alpha, Solver::SolutionInfo* si, Solver_Budget *budget)
 {
 	int l = prob->l;
 	double *zeros = new double[l];
@@ -1645,7 +1815,7 @@ static void solve_one_class(
 
 	Solver s;
 	s.Solve(l, ONE_CLASS_Q(*prob,*param), zeros, ones,
-		alpha, 1.0, 1.0, param->eps, si, param->shrinking);
+		alpha, 1.0, 1.0, param->eps, si, param->shrinking, budget);
 
 	delete[] zeros;
 	delete[] ones;
@@ -1736,22 +1906,24 @@ struct decision_function
 	double rho;
 };
 
+// alpha0, if not NULL, holds the coefficients of a previous solution used as
+// the starting point of the solver (classification only)
 static decision_function svm_train_one(
 	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn)
+	double Cp, double Cn, const double *alpha0, Solver_Budget *budget)
 {
 	double *alpha = Malloc(double,prob->l);
 	Solver::SolutionInfo si;
 	switch(param->svm_type)
 	{
 		case C_SVC:
-			solve_c_svc(prob,param,alpha,&si,Cp,Cn);
+			solve_c_svc(prob,param,alpha,&si,Cp,Cn,alpha0,budget);
 			break;
 		case NU_SVC:
-			solve_nu_svc(prob,param,alpha,&si);
+			solve_nu_svc(prob,param,alpha,&si,alpha0,budget);
 			break;
 		case ONE_CLASS:
-			solve_one_class(prob,param,alpha,&si);
+			solve_one_class(prob,param,alpha,&si,budget);
 			break;
 		case EPSILON_SVR:
 			solve_epsilon_svr(prob,param,alpha,&si);
@@ -1982,28 +2154,41 @@ static void multiclass_probability(int k, double **r, double *p)
 }
 
 // Cross-validation decision values for probability estimates
+// The folds are trained in parallel, each starting from the solution on the
+// whole problem (alpha0, signed coefficients) when given
 static void svm_binary_svc_probability(
 	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn, double& probA, double& probB)
+	double Cp, double Cn, double& probA, double& probB,
+	const double *alpha0, Solver_Budget *budget)
 {
 	int i;
 	int nr_fold = 5;
 	int *perm = Malloc(int,prob->l);
 	double *dec_values = Malloc(double,prob->l);
+	Solver_Budget *fold_budget = Malloc(Solver_Budget,nr_fold);
 
-	// random shuffle
+	// random shuffle, with a generator of its own so that concurrent
+	// trainings do not share one
+	std::minstd_rand rng;
 	for(i=0;i<prob->l;i++) perm[i]=i;
 	for(i=0;i<prob->l;i++)
 	{
-		int j = i+rand()%(prob->l-i);
+		int j = i+rng()%(prob->l-i);
 		swap(perm[i],perm[j]);
 	}
 	for(i=0;i<nr_fold;i++)
 	{
+		fold_budget[i] = *budget;
+		clear_stats(&fold_budget[i].stats);
+	}
+	parallel_for(nr_fold, [&](size_t fold)
+	{
+		int i = (int)fold;
 		int begin = i*prob->l/nr_fold;
 		int end = (i+1)*prob->l/nr_fold;
 		int j,k;
 		struct svm_problem subprob;
+		double *subalpha0 = NULL;
 
 		subprob.l = prob->l-(end-begin);
 #ifdef _DENSE_REP
@@ -2012,18 +2197,18 @@ static void svm_binary_svc_probability(
 		subprob.x = Malloc(struct svm_node*,subprob.l);
 #endif
 		subprob.y = Malloc(double,subprob.l);
+		if(alpha0)
+			subalpha0 = Malloc(double,subprob.l);
 
 		k=0;
-		for(j=0;j<begin;j++)
-		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		for(j=end;j<prob->l;j++)
+		for(j=0;j<prob->l;j++)
 		{
+			if(j>=begin && j<end)
+				continue;
 			subprob.x[k] = prob->x[perm[j]];
 			subprob.y[k] = prob->y[perm[j]];
+			if(alpha0)
+				subalpha0[k] = alpha0[perm[j]];
 			++k;
 		}
 		int p_count=0,n_count=0;
@@ -2044,34 +2229,30 @@ static void svm_binary_svc_probability(
 				dec_values[perm[j]] = -1;
 		else
 		{
-			svm_parameter subparam = *param;
-			subparam.probability=0;
-			subparam.C=1.0;
-			subparam.nr_weight=2;
-			subparam.weight_label = Malloc(int,2);
-			subparam.weight = Malloc(double,2);
-			subparam.weight_label[0]=+1;
-			subparam.weight_label[1]=-1;
-			subparam.weight[0]=Cp;
-			subparam.weight[1]=Cn;
-			struct svm_model *submodel = svm_train(&subprob,&subparam);
+			// labels are +1/-1, so the decision values need no reordering
+			decision_function f = svm_train_one(&subprob,param,Cp,Cn,subalpha0,&fold_budget[i]);
 			for(j=begin;j<end;j++)
 			{
+				double sum = 0;
+				for(k=0;k<subprob.l;k++)
+					if(f.alpha[k] != 0)
 #ifdef _DENSE_REP
-				svm_predict_values(submodel,(prob->x+perm[j]),&(dec_values[perm[j]])); 
+						sum += f.alpha[k]*Kernel::k_function(subprob.x+k,prob->x+perm[j],*param);
 #else
-				svm_predict_values(submodel,prob->x[perm[j]],&(dec_values[perm[j]])); 
+						sum += f.alpha[k]*Kernel::k_function(subprob.x[k],prob->x[perm[j]],*param);
 #endif
-				// ensure +1 -1 order; reason not using CV subroutine
-				dec_values[perm[j]] *= submodel->label[0];
+				dec_values[perm[j]] = sum - f.rho;
 			}
-			svm_free_and_destroy_model(&submodel);
-			svm_destroy_param(&subparam);
+			free(f.alpha);
 		}
+		free(subalpha0);
 		free(subprob.x);
 		free(subprob.y);
-	}
+	});
+	for(i=0;i<nr_fold;i++)
+		add_stats(&budget->stats,fold_budget[i].stats);
 	sigmoid_train(prob->l,dec_values,prob->y,probA,probB);
+	free(fold_budget);
 	free(dec_values);
 	free(perm);
 }
@@ -2186,14 +2367,39 @@ static void svm_group_classes(const svm_problem *prob, int *nr_class_ret, int **
 	free(data_label);
 }
 
+// whether decision functions trained with both parameter sets are the same
+static bool svm_same_training_param(const svm_parameter *a, const svm_parameter *b)
+{
+	if(a->svm_type != b->svm_type || a->kernel_type != b->kernel_type ||
+	   a->degree != b->degree || a->gamma != b->gamma || a->coef0 != b->coef0 ||
+	   a->C != b->C || a->nu != b->nu || a->probability != b->probability ||
+	   a->nr_weight != b->nr_weight)
+		return false;
+	for(int i=0;i<a->nr_weight;i++)
+		if(a->weight_label[i] != b->weight_label[i] || a->weight[i] != b->weight[i])
+			return false;
+	return true;
+}
+
 //
 // Interface functions
 //
-svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
+
+// init, if not NULL, is a model previously trained on a subset of the points
+// of prob; init_index[i] is the index of point i in its training set, or -1
+static svm_model *svm_train_internal(const svm_problem *prob, const svm_parameter *param,
+				     const svm_model *init, const int *init_index)
 {
+	double start_time = wall_time();
+	Solver_Budget budget = solver_budget(param);
+
 	svm_model *model = Malloc(svm_model,1);
 	model->param = *param;
 	model->free_sv = 0;	// XXX
+	model->nr_scale = 0;
+	model->x_shift = NULL;
+	model->x_scale = NULL;
+	memset(&model->reduction,0,sizeof(model->reduction));
 
 	if(param->svm_type == ONE_CLASS ||
 	   param->svm_type == EPSILON_SVR ||
@@ -2214,7 +2420,7 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 			model->probA[0] = svm_svr_probability(prob,param);
 		}
 
-		decision_function f = svm_train_one(prob,param,0,0);
+		decision_function f = svm_train_one(prob,param,0,0,NULL,&budget);
 		model->rho = Malloc(double,1);
 		model->rho[0] = f.rho;
 
@@ -2283,6 +2489,56 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				weighted_C[j] *= param->weight[i];
 		}
 
+		// map the SVs of the previous model onto the grouped training data
+
+		int *init_class = NULL;		// class of the previous model with the same label
+		int *init_start = NULL;		// start of each class among its SVs
+		int *init_pos = NULL;		// position of each of its SVs in x, or -1
+		bool *has_new = NULL;		// class contains points it was not trained on
+		bool reuse = false;
+		if(init)
+		{
+			int nr_init = init->nr_class;
+			reuse = svm_same_training_param(&init->param,param);
+
+			init_class = Malloc(int,nr_class);
+			has_new = Malloc(bool,nr_class);
+			for(i=0;i<nr_class;i++)
+			{
+				init_class[i] = -1;
+				for(int j=0;j<nr_init;j++)
+					if(init->label[j] == label[i])
+						init_class[i] = j;
+				has_new[i] = init_class[i] < 0;
+				for(int k=start[i];k<start[i]+count[i];k++)
+					if(init_index[perm[k]] < 0)
+						has_new[i] = true;
+			}
+
+			init_start = Malloc(int,nr_init);
+			init_start[0] = 0;
+			for(i=1;i<nr_init;i++)
+				init_start[i] = init_start[i-1]+init->nSV[i-1];
+
+			int nr_index = 0;
+			for(i=0;i<l;i++)
+				nr_index = max(nr_index,init_index[i]+1);
+			int *index_pos = Malloc(int,nr_index);
+			for(i=0;i<nr_index;i++)
+				index_pos[i] = -1;
+			for(i=0;i<l;i++)
+				if(init_index[perm[i]] >= 0)
+					index_pos[init_index[perm[i]]] = i;
+
+			init_pos = Malloc(int,init->l);
+			for(i=0;i<init->l;i++)
+			{
+				int t = init->sv_indices[i]-1;
+				init_pos[i] = t < nr_index ? index_pos[t] : -1;
+			}
+			free(index_pos);
+		}
+
 		// train k*(k-1)/2 models
 
 		bool *nonzero = Malloc(bool,l);
@@ -2297,46 +2553,117 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 			probB=Malloc(double,nr_class*(nr_class-1)/2);
 		}
 
+		// the pairs are trained in parallel, each with a budget of its own
+		int nr_pair = nr_class*(nr_class-1)/2;
+		int *pair_class = Malloc(int,2*nr_pair);
+		Solver_Budget *pair_budget = Malloc(Solver_Budget,nr_pair);
 		int p = 0;
 		for(i=0;i<nr_class;i++)
 			for(int j=i+1;j<nr_class;j++)
 			{
-				svm_problem sub_prob;
-				int si = start[i], sj = start[j];
-				int ci = count[i], cj = count[j];
-				sub_prob.l = ci+cj;
+				pair_class[2*p] = i;
+				pair_class[2*p+1] = j;
+				pair_budget[p] = budget;
+				clear_stats(&pair_budget[p].stats);
+				++p;
+			}
+		parallel_for(nr_pair, [&](size_t pair)
+		{
+			int p = (int)pair;
+			int i = pair_class[2*p], j = pair_class[2*p+1];
+			svm_problem sub_prob;
+			int si = start[i], sj = start[j];
+			int ci = count[i], cj = count[j];
+			sub_prob.l = ci+cj;
 #ifdef _DENSE_REP
-				sub_prob.x = Malloc(svm_node,sub_prob.l);
+			sub_prob.x = Malloc(svm_node,sub_prob.l);
 #else
-				sub_prob.x = Malloc(svm_node *,sub_prob.l);
+			sub_prob.x = Malloc(svm_node *,sub_prob.l);
 #endif
-				sub_prob.y = Malloc(double,sub_prob.l);
-				int k;
-				for(k=0;k<ci;k++)
+			sub_prob.y = Malloc(double,sub_prob.l);
+			int k;
+			for(k=0;k<ci;k++)
+			{
+				sub_prob.x[k] = x[si+k];
+				sub_prob.y[k] = +1;
+			}
+			for(k=0;k<cj;k++)
+			{
+				sub_prob.x[ci+k] = x[sj+k];
+				sub_prob.y[ci+k] = -1;
+			}
+
+			// coefficients of the previous solution for this pair
+			double *alpha0 = NULL;
+			double sign = 1;
+			int q = -1;
+			if(init && init_class[i] >= 0 && init_class[j] >= 0)
+			{
+				int a = init_class[i], b = init_class[j];
+				if(a > b)
 				{
-					sub_prob.x[k] = x[si+k];
-					sub_prob.y[k] = +1;
+					swap(a,b);
+					sign = -1;
 				}
-				for(k=0;k<cj;k++)
+				q = a*(2*init->nr_class-a-1)/2 + b-a-1;
+
+				alpha0 = Malloc(double,sub_prob.l);
+				for(k=0;k<sub_prob.l;k++)
+					alpha0[k] = 0;
+				for(int c=0;c<2;c++)
 				{
-					sub_prob.x[ci+k] = x[sj+k];
-					sub_prob.y[ci+k] = -1;
+					int sv_class = c == 0 ? a : b;
+					double *coef = c == 0 ? init->sv_coef[b-1] : init->sv_coef[a];
+					for(int sv=init_start[sv_class];sv<init_start[sv_class]+init->nSV[sv_class];sv++)
+					{
+						int pos = init_pos[sv];
+						if(pos >= si && pos < si+ci)
+							alpha0[pos-si] = sign*coef[sv];
+						else if(pos >= sj && pos < sj+cj)
+							alpha0[ci+pos-sj] = sign*coef[sv];
+					}
 				}
+			}
 
+			if(alpha0 && reuse && !has_new[i] && !has_new[j])
+			{
+				// no new points in either class, keep the previous solution
+				info("reusing decision function %d vs. %d\n",label[i],label[j]);
+				f[p].alpha = alpha0;
+				f[p].rho = sign*init->rho[q];
 				if(param->probability)
-					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p]);
+				{
+					probA[p] = init->probA[q];
+					probB[p] = sign*init->probB[q];
+				}
+			}
+			else
+			{
+				f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j],alpha0,&pair_budget[p]);
+				free(alpha0);
 
-				f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j]);
-				for(k=0;k<ci;k++)
-					if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
-						nonzero[si+k] = true;
-				for(k=0;k<cj;k++)
-					if(!nonzero[sj+k] && fabs(f[p].alpha[ci+k]) > 0)
-						nonzero[sj+k] = true;
-				free(sub_prob.x);
-				free(sub_prob.y);
-				++p;
+				if(param->probability)
+					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p],f[p].alpha,&pair_budget[p]);
 			}
+			free(sub_prob.x);
+			free(sub_prob.y);
+		});
+
+		for(p=0;p<nr_pair;p++)
+		{
+			int si = start[pair_class[2*p]], sj = start[pair_class[2*p+1]];
+			int ci = count[pair_class[2*p]], cj = count[pair_class[2*p+1]];
+			int k;
+			add_stats(&budget.stats,pair_budget[p].stats);
+			for(k=0;k<ci;k++)
+				if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
+					nonzero[si+k] = true;
+			for(k=0;k<cj;k++)
+				if(!nonzero[sj+k] && fabs(f[p].alpha[ci+k]) > 0)
+					nonzero[sj+k] = true;
+		}
+		free(pair_class);
+		free(pair_budget);
 
 		// build output
 
@@ -2433,6 +2760,10 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				++p;
 			}
 
+		free(init_class);
+		free(init_start);
+		free(init_pos);
+		free(has_new);
 		free(label);
 		free(probA);
 		free(probB);
@@ -2448,9 +2779,32 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		free(nz_count);
 		free(nz_start);
 	}
+
+	budget.stats.time = wall_time() - start_time;
+	model->stats = budget.stats;
+	info("#iter = %d, time = %gs, eps = %g, status = %d\n",
+	     model->stats.iter,model->stats.time,model->stats.eps,model->stats.status);
 	return model;
 }
 
+svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
+{
+	return svm_train_internal(prob,param,NULL,NULL);
+}
+
+svm_model *svm_train_warm(const svm_problem *prob, const svm_parameter *param,
+			  const svm_model *init, const int *init_index)
+{
+	// the previous solution can only be mapped back for trained classifiers
+	if(init == NULL || init_index == NULL || init->sv_indices == NULL ||
+	   init->label == NULL || init->nSV == NULL ||
+	   (param->svm_type != C_SVC && param->svm_type != NU_SVC) ||
+	   init->param.svm_type != param->svm_type)
+		return svm_train_internal(prob,param,NULL,NULL);
+
+	return svm_train_internal(prob,param,init,init_index);
+}
+
 // Stratified cross validation
 void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
 {
@@ -2459,6 +2813,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 	int l = prob->l;
 	int *perm = Malloc(int,l);
 	int nr_class;
+	std::minstd_rand rng;
 	if (nr_fold > l)
 	{
 		nr_fold = l;
@@ -2484,7 +2839,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for (c=0; c<nr_class; c++)
 			for(i=0;i<count[c];i++)
 			{
-				int j = i+rand()%(count[c]-i);
+				int j = i+rng()%(count[c]-i);
 				swap(index[start[c]+j],index[start[c]+i]);
 			}
 		for(i=0;i<nr_fold;i++)
@@ -2521,7 +2876,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for(i=0;i<l;i++) perm[i]=i;
 		for(i=0;i<l;i++)
 		{
-			int j = i+rand()%(l-i);
+			int j = i+rng()%(l-i);
 			swap(perm[i],perm[j]);
 		}
 		for(i=0;i<=nr_fold;i++)
@@ -2626,7 +2981,7 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
-double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+static double svm_predict_values_raw(const svm_model *model, const svm_node *x, double* dec_values)
 {
 	int i;
 	if(model->param.svm_type == ONE_CLASS ||
@@ -2711,6 +3066,28 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 	}
 }
 
+double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+{
+	if(model->nr_scale == 0)
+		return svm_predict_values_raw(model, x, dec_values);
+
+	// standardize the input the same way as the training data, in a buffer
+	// of the thread reused across predictions as models are shared by threads
+	static thread_local std::vector<double> buffer;
+	if(buffer.size() < (size_t)x->dim)
+		buffer.resize(x->dim);
+	svm_node scaled;
+	scaled.dim = x->dim;
+	scaled.values = buffer.data();
+	for(int i=0;i<x->dim;i++)
+		if(i < model->nr_scale)
+			scaled.values[i] = (x->values[i] - model->x_shift[i]) * model->x_scale[i];
+		else
+			scaled.values[i] = x->values[i];
+
+	return svm_predict_values_raw(model, &scaled, dec_values);
+}
+
 double svm_predict(const svm_model *model, const svm_node *x)
 {
 	int nr_class = model->nr_class;
@@ -2726,6 +3103,11 @@ double svm_predict(const svm_model *model, const svm_node *x)
 	return pred_result;
 }
 
+double svm_kernel(const svm_node *x, const svm_node *y, const svm_parameter *param)
+{
+	return Kernel::k_function(x,y,*param);
+}
+
 double svm_predict_probability(
 	const svm_model *model, const svm_node *x, double *prob_estimates)
 {
@@ -2771,6 +3153,782 @@ double svm_predict_probability(
 		return svm_predict(model, x);
 }
 
+//
+// Predictor
+//
+#define PREDICTOR_ALIGN 64
+// number of terms between checks of the bound of a two-class model
+#define BOUND_STEP 4
+// bounded sums are paused for BOUND_PAUSE predictions if the last BOUND_TRIAL
+// ones computed more than 3/4 of the terms
+#define BOUND_TRIAL 64
+#define BOUND_PAUSE 4096
+
+static void *malloc_aligned(size_t size)
+{
+	// aligned_alloc needs a multiple of the alignment
+	size = (size + PREDICTOR_ALIGN - 1) / PREDICTOR_ALIGN * PREDICTOR_ALIGN;
+	return aligned_alloc(PREDICTOR_ALIGN, size > 0 ? size : PREDICTOR_ALIGN);
+}
+
+// allocates the arrays of a predictor of the given shape, NULL if out of memory
+static svm_predictor *svm_predictor_alloc(int nr_class, int l, int dim, int nr_dec,
+					  int nr_coef, bool scaled, bool labeled)
+{
+	svm_predictor *pred = Malloc(svm_predictor,1);
+	if(pred == NULL)
+		return NULL;
+	memset(pred,0,sizeof(svm_predictor));
+	pred->nr_class = nr_class;
+	pred->l = l;
+	pred->dim = dim;
+	pred->nr_dec = nr_dec;
+	pred->nr_coef = nr_coef;
+
+	pred->SV = (double *)malloc_aligned(sizeof(double)*l*dim);
+	pred->start = Malloc(int,nr_class);
+	pred->nSV = Malloc(int,nr_class);
+	pred->coef = (double *)malloc_aligned(sizeof(double)*nr_coef);
+	pred->coef_start = Malloc(int,nr_dec);
+	pred->rho = Malloc(double,nr_dec);
+	if(labeled)
+		pred->label = Malloc(int,nr_class);
+	if(scaled)
+	{
+		pred->x_shift = Malloc(double,dim);
+		pred->x_scale = Malloc(double,dim);
+	}
+	pred->x = (double *)malloc_aligned(sizeof(double)*dim);
+	pred->kvalue = (double *)malloc_aligned(sizeof(double)*l);
+	pred->dec_values = Malloc(double,nr_dec);
+	pred->vote = Malloc(int,nr_class);
+	pred->pending = Malloc(int,nr_class);
+	pred->ready = Malloc(int,nr_class);
+	pred->done = Malloc(int,nr_dec);
+	bool binary = labeled && nr_class == 2;
+	if(binary)
+	{
+		pred->order = Malloc(int,l);
+		pred->coef_bound = Malloc(double,l+1);
+		pred->norm_min = Malloc(double,l+1);
+		pred->norm_max = Malloc(double,l+1);
+	}
+
+	if(!pred->SV || !pred->start || !pred->nSV || !pred->coef || !pred->coef_start ||
+	   !pred->rho || (labeled && !pred->label) || (scaled && (!pred->x_shift || !pred->x_scale)) ||
+	   !pred->x || !pred->kvalue || !pred->dec_values || !pred->vote ||
+	   !pred->pending || !pred->ready || !pred->done ||
+	   (binary && (!pred->order || !pred->coef_bound || !pred->norm_min || !pred->norm_max)))
+	{
+		svm_predictor_free(pred);
+		return NULL;
+	}
+	return pred;
+}
+
+// Expands POLY and LINEAR decision functions into weights of the monomials of
+// the input, if that is cheaper to evaluate:
+//
+//	(gamma x.s + coef0)^d = sum_{|a| <= d} C(d,|a|) coef0^(d-|a|) gamma^|a| |a|!/a! s^a x^a
+//
+// The monomials are enumerated by degree, each one being a monomial of the
+// previous degree times a variable at least as large as its last one.
+static svm_predictor *svm_predictor_expand(svm_predictor *pred)
+{
+	const svm_parameter& param = pred->param;
+	int degree;
+	double gamma, coef0;
+	if(param.kernel_type == LINEAR)
+	{
+		degree = 1;
+		gamma = 1;
+		coef0 = 0;
+	}
+	else if(param.kernel_type == POLY && param.degree >= 0)
+	{
+		degree = param.degree;
+		gamma = param.gamma;
+		coef0 = param.coef0;
+	}
+	else
+		return pred;
+
+	int dim = pred->dim;
+	int nr_dec = pred->nr_dec;
+
+	// C(dim+degree, degree) monomials, against the cost of the kernel sums
+	double count = 1;
+	for(int j=1;j<=degree;j++)
+		count = count*(dim+j)/j;
+	if(count*(nr_dec+1) >= (double)pred->l*(dim+1) + pred->nr_coef)
+		return pred;
+	int M = (int)(count + 0.5);
+
+	pred->mono_parent = Malloc(int,M);
+	pred->mono_var = Malloc(int,M);
+	pred->w = (double *)malloc_aligned(sizeof(double)*nr_dec*M);
+	pred->monomial = (double *)malloc_aligned(sizeof(double)*M);
+	int *deg = Malloc(int,M);
+	int *last_exp = Malloc(int,M);
+	double *factor = Malloc(double,M);
+	double *sv_monomial = Malloc(double,M);
+	if(!pred->mono_parent || !pred->mono_var || !pred->w || !pred->monomial ||
+	   !deg || !last_exp || !factor || !sv_monomial)
+	{
+		free(deg);
+		free(last_exp);
+		free(factor);
+		free(sv_monomial);
+		svm_predictor_free(pred);
+		return NULL;
+	}
+	pred->nr_monomial = M;
+
+	// factor[t] accumulates a! first
+	int t = 0, n = 1;
+	pred->mono_parent[0] = 0;
+	pred->mono_var[0] = 0;
+	deg[0] = 0;
+	last_exp[0] = 0;
+	factor[0] = 1;
+	for(int j=1;j<=degree;j++)
+	{
+		int end = n;
+		for(;t<end;t++)
+		{
+			int first = deg[t] == 0 ? 0 : pred->mono_var[t];
+			for(int v=first;v<dim;v++)
+			{
+				pred->mono_parent[n] = t;
+				pred->mono_var[n] = v;
+				deg[n] = j;
+				last_exp[n] = deg[t] > 0 && v == pred->mono_var[t] ? last_exp[t]+1 : 1;
+				factor[n] = factor[t]*last_exp[n];
+				n++;
+			}
+		}
+	}
+
+	for(t=0;t<M;t++)
+	{
+		// C(d,j) j! = d!/(d-j)!
+		double f = 1;
+		for(int k=degree-deg[t]+1;k<=degree;k++)
+			f *= k;
+		f *= powi(gamma,deg[t]) * powi(coef0,degree-deg[t]);
+		factor[t] = f/factor[t];
+	}
+
+	for(int k=0;k<nr_dec*M;k++)
+		pred->w[k] = 0;
+
+	// adds the terms of SV k with coefficient c to decision function p
+	auto add_sv = [&](int p, int k, double c)
+	{
+		const double *sv = pred->SV + (size_t)k*dim;
+		double *w = pred->w + (size_t)p*M;
+		sv_monomial[0] = 1;
+		for(int t=1;t<M;t++)
+			sv_monomial[t] = sv_monomial[pred->mono_parent[t]]*sv[pred->mono_var[t]];
+		for(int t=0;t<M;t++)
+			w[t] += c*factor[t]*sv_monomial[t];
+	};
+
+	if(pred->label == NULL)
+		for(int k=0;k<pred->l;k++)
+			add_sv(0,k,pred->coef[k]);
+	else
+	{
+		int p = 0;
+		for(int i=0;i<pred->nr_class;i++)
+			for(int j=i+1;j<pred->nr_class;j++)
+			{
+				const double *coef = pred->coef + pred->coef_start[p];
+				int ci = pred->nSV[i];
+				for(int k=0;k<ci;k++)
+					add_sv(p,pred->start[i]+k,coef[k]);
+				for(int k=0;k<pred->nSV[j];k++)
+					add_sv(p,pred->start[j]+k,coef[ci+k]);
+				p++;
+			}
+	}
+
+	free(deg);
+	free(last_exp);
+	free(factor);
+	free(sv_monomial);
+	return pred;
+}
+
+// largest |K(x,s)| over the SVs s with norms in [norm_min,norm_max], for
+// ||x|| = x_norm
+static inline double kernel_bound(const svm_parameter& param, double x_norm,
+				  double norm_min, double norm_max)
+{
+	switch(param.kernel_type)
+	{
+		case LINEAR:
+			return x_norm*norm_max;
+		case POLY:
+			return powi(fabs(param.gamma)*x_norm*norm_max+fabs(param.coef0),param.degree);
+		case RBF:
+		{
+			// ||x-s|| >= | ||x|| - ||s|| |
+			double d = max(max(norm_min-x_norm,x_norm-norm_max),0.0);
+			return exp(-param.gamma*d*d);
+		}
+		default:
+			return 1;
+	}
+}
+
+// Orders the SVs of a two-class model by decreasing bound of their term for
+// inputs of norm 1, and bounds the terms left after each of them.
+static void svm_predictor_bounds(svm_predictor *pred)
+{
+	int l = pred->l;
+	int dim = pred->dim;
+	double *norm = Malloc(double,l);
+	double *key = Malloc(double,l);
+	for(int i=0;i<l;i++)
+	{
+		const double *sv = pred->SV + (size_t)i*dim;
+		double sum = 0;
+		for(int k=0;k<dim;k++)
+			sum += sv[k]*sv[k];
+		norm[i] = sqrt(sum);
+		key[i] = fabs(pred->coef[i])*kernel_bound(pred->param,1,norm[i],norm[i]);
+		pred->order[i] = i;
+	}
+	std::stable_sort(pred->order,pred->order+l,[&](int a, int b) { return key[a] > key[b]; });
+
+	pred->coef_bound[l] = 0;
+	pred->norm_min[l] = HUGE_VAL;
+	pred->norm_max[l] = 0;
+	for(int k=l-1;k>=0;k--)
+	{
+		int i = pred->order[k];
+		pred->coef_bound[k] = pred->coef_bound[k+1] + fabs(pred->coef[i]);
+		pred->norm_min[k] = min(pred->norm_min[k+1],norm[i]);
+		pred->norm_max[k] = max(pred->norm_max[k+1],norm[i]);
+	}
+	free(norm);
+	free(key);
+}
+
+svm_predictor *svm_predictor_create(const svm_model *model)
+{
+	if(model->param.kernel_type == PRECOMPUTED)
+		return NULL;
+
+	int i,j,k;
+	int l = model->l;
+	int svm_type = model->param.svm_type;
+	bool classification = svm_type == C_SVC || svm_type == NU_SVC;
+	int nr_class = classification ? model->nr_class : 2;
+	int nr_dec = classification ? nr_class*(nr_class-1)/2 : 1;
+	int nr_coef = classification ? (nr_class-1)*l : l;
+
+	int dim = model->nr_scale;
+	for(i=0;i<l;i++)
+#ifdef _DENSE_REP
+		dim = max(dim,model->SV[i].dim);
+#else
+		for(const svm_node *p = model->SV[i]; p->index != -1; p++)
+			dim = max(dim,p->index);
+#endif
+
+	svm_predictor *pred = svm_predictor_alloc(nr_class,l,dim,nr_dec,nr_coef,
+						  model->nr_scale > 0,classification);
+	if(pred == NULL)
+		return NULL;
+
+	pred->param = model->param;
+	pred->param.nr_weight = 0;
+	pred->param.weight_label = NULL;
+	pred->param.weight = NULL;
+
+	// SVs, padded with zeros
+	for(i=0;i<l;i++)
+	{
+		double *sv = pred->SV + (size_t)i*dim;
+		for(k=0;k<dim;k++)
+			sv[k] = 0;
+#ifdef _DENSE_REP
+		for(k=0;k<model->SV[i].dim;k++)
+			sv[k] = model->SV[i].values[k];
+#else
+		for(const svm_node *p = model->SV[i]; p->index != -1; p++)
+			sv[p->index-1] = p->value;
+#endif
+	}
+
+	if(model->nr_scale > 0)
+		for(k=0;k<dim;k++)
+		{
+			pred->x_shift[k] = k < model->nr_scale ? model->x_shift[k] : 0;
+			pred->x_scale[k] = k < model->nr_scale ? model->x_scale[k] : 1;
+		}
+
+	if(!classification)
+	{
+		pred->start[0] = 0;
+		pred->nSV[0] = l;
+		pred->nSV[1] = 0;
+		pred->start[1] = l;
+		pred->coef_start[0] = 0;
+		pred->rho[0] = model->rho[0];
+		for(k=0;k<l;k++)
+			pred->coef[k] = model->sv_coef[0][k];
+		return svm_predictor_expand(pred);
+	}
+
+	for(i=0;i<nr_class;i++)
+	{
+		pred->label[i] = model->label[i];
+		pred->nSV[i] = model->nSV[i];
+		pred->start[i] = i == 0 ? 0 : pred->start[i-1]+model->nSV[i-1];
+	}
+
+	// coefficients of each decision function next to each other
+	int p = 0, offset = 0;
+	for(i=0;i<nr_class;i++)
+		for(j=i+1;j<nr_class;j++)
+		{
+			int si = pred->start[i], ci = pred->nSV[i];
+			int sj = pred->start[j], cj = pred->nSV[j];
+			pred->coef_start[p] = offset;
+			pred->rho[p] = model->rho[p];
+			for(k=0;k<ci;k++)
+				pred->coef[offset++] = model->sv_coef[j-1][si+k];
+			for(k=0;k<cj;k++)
+				pred->coef[offset++] = model->sv_coef[i][sj+k];
+			p++;
+		}
+
+	if(nr_class == 2)
+		svm_predictor_bounds(pred);
+
+	return svm_predictor_expand(pred);
+}
+
+svm_predictor *svm_predictor_copy(const svm_predictor *src)
+{
+	svm_predictor *pred = svm_predictor_alloc(src->nr_class,src->l,src->dim,src->nr_dec,
+						  src->nr_coef,src->x_shift != NULL,src->label != NULL);
+	if(pred == NULL)
+		return NULL;
+
+	pred->param = src->param;
+	memcpy(pred->SV,src->SV,sizeof(double)*src->l*src->dim);
+	memcpy(pred->start,src->start,sizeof(int)*src->nr_class);
+	memcpy(pred->nSV,src->nSV,sizeof(int)*src->nr_class);
+	memcpy(pred->coef,src->coef,sizeof(double)*src->nr_coef);
+	memcpy(pred->coef_start,src->coef_start,sizeof(int)*src->nr_dec);
+	memcpy(pred->rho,src->rho,sizeof(double)*src->nr_dec);
+	if(src->label)
+		memcpy(pred->label,src->label,sizeof(int)*src->nr_class);
+	if(src->x_shift)
+	{
+		memcpy(pred->x_shift,src->x_shift,sizeof(double)*src->dim);
+		memcpy(pred->x_scale,src->x_scale,sizeof(double)*src->dim);
+	}
+
+	int M = src->nr_monomial;
+	if(M > 0)
+	{
+		pred->mono_parent = Malloc(int,M);
+		pred->mono_var = Malloc(int,M);
+		pred->w = (double *)malloc_aligned(sizeof(double)*src->nr_dec*M);
+		pred->monomial = (double *)malloc_aligned(sizeof(double)*M);
+		if(!pred->mono_parent || !pred->mono_var || !pred->w || !pred->monomial)
+		{
+			svm_predictor_free(pred);
+			return NULL;
+		}
+		pred->nr_monomial = M;
+		memcpy(pred->mono_parent,src->mono_parent,sizeof(int)*M);
+		memcpy(pred->mono_var,src->mono_var,sizeof(int)*M);
+		memcpy(pred->w,src->w,sizeof(double)*src->nr_dec*M);
+	}
+
+	pred->fast = src->fast;
+	pred->bound_calls = src->bound_calls;
+	pred->bound_terms = src->bound_terms;
+	pred->bound_pause = src->bound_pause;
+	if(src->order)
+	{
+		memcpy(pred->order,src->order,sizeof(int)*src->l);
+		memcpy(pred->coef_bound,src->coef_bound,sizeof(double)*(src->l+1));
+		memcpy(pred->norm_min,src->norm_min,sizeof(double)*(src->l+1));
+		memcpy(pred->norm_max,src->norm_max,sizeof(double)*(src->l+1));
+	}
+	return pred;
+}
+
+svm_predictor *svm_predictor_share(const svm_predictor *src)
+{
+	svm_predictor *pred = Malloc(svm_predictor,1);
+	if(pred == NULL)
+		return NULL;
+	*pred = *src;
+	pred->shared = 1;
+
+	int M = src->nr_monomial;
+	pred->x = (double *)malloc_aligned(sizeof(double)*src->dim);
+	pred->kvalue = (double *)malloc_aligned(sizeof(double)*src->l);
+	pred->dec_values = Malloc(double,src->nr_dec);
+	pred->vote = Malloc(int,src->nr_class);
+	pred->pending = Malloc(int,src->nr_class);
+	pred->ready = Malloc(int,src->nr_class);
+	pred->done = Malloc(int,src->nr_dec);
+	pred->monomial = M > 0 ? (double *)malloc_aligned(sizeof(double)*M) : NULL;
+	if(!pred->x || !pred->kvalue || !pred->dec_values || !pred->vote ||
+	   !pred->pending || !pred->ready || !pred->done || (M > 0 && !pred->monomial))
+	{
+		svm_predictor_free(pred);
+		return NULL;
+	}
+	return pred;
+}
+
+static inline double predictor_kernel(const svm_predictor *pred, const double *px, int i)
+{
+	const svm_parameter& param = pred->param;
+	int dim = pred->dim;
+	const double *sv = pred->SV + (size_t)i*dim;
+	double sum = 0;
+	if(param.kernel_type == RBF)
+	{
+		for(int k=0;k<dim;k++)
+		{
+			double d = px[k] - sv[k];
+			sum += d*d;
+		}
+		return exp(-param.gamma*sum);
+	}
+	for(int k=0;k<dim;k++)
+		sum += px[k]*sv[k];
+	switch(param.kernel_type)
+	{
+		case LINEAR:
+			return sum;
+		case POLY:
+			return powi(param.gamma*sum+param.coef0,param.degree);
+		case SIGMOID:
+			return tanh(param.gamma*sum+param.coef0);
+	}
+	return 0;
+}
+
+// decision function p between classes i and j, from their kernel values
+static inline double predictor_decision(const svm_predictor *pred, int p, int i, int j)
+{
+	const double *coef = pred->coef + pred->coef_start[p];
+	int ci = pred->nSV[i];
+	int cj = pred->label ? pred->nSV[j] : 0;
+	const double *ki = pred->kvalue + pred->start[i];
+	const double *kj = pred->kvalue + pred->start[j];
+
+	double sum = 0;
+	for(int k=0;k<ci;k++)
+		sum += coef[k] * ki[k];
+	for(int k=0;k<cj;k++)
+		sum += coef[ci+k] * kj[k];
+	return sum - pred->rho[p];
+}
+
+// Sums the terms of a two-class model by decreasing bound, and stops when the
+// terms left cannot change the sign of the decision value. The bound is only
+// checked every few terms, as it costs about as much as a term. Returns
+// whether the sign was decided, storing the label of its class in `label`, as
+// it may also depend on the order of the sum.
+static bool predict_binary_bounded(svm_predictor *pred, const double *px, int *label)
+{
+	int dim = pred->dim;
+	int l = pred->l;
+	double x_norm = 0;
+	for(int k=0;k<dim;k++)
+		x_norm += px[k]*px[k];
+	x_norm = sqrt(x_norm);
+
+	double rho = pred->rho[0];
+	double sum = 0, abs_sum = fabs(rho);
+	for(int k=0;k<l;k++)
+	{
+		int i = pred->order[k];
+		double term = pred->coef[i]*predictor_kernel(pred,px,i);
+		sum += term;
+		abs_sum += fabs(term);
+
+		if((k+1)%BOUND_STEP != 0 && k+1 < l)
+			continue;
+		double left = pred->coef_bound[k+1]*kernel_bound(pred->param,x_norm,
+								 pred->norm_min[k+1],pred->norm_max[k+1]);
+		// margin for the rounding errors of both ways of summing
+		double slack = 1e-10*(abs_sum+left);
+		if(fabs(sum-rho) > left+slack)
+		{
+			pred->bound_terms += k+1;
+			*label = sum-rho > 0 ? pred->label[0] : pred->label[1];
+			return true;
+		}
+	}
+	pred->bound_terms += l;
+	return false;
+}
+
+// Evaluates the decision functions of the most promising classes first, and
+// stops as soon as no other class can win the vote, ties going to the first
+// class as in the full vote.
+static int predict_vote_early(svm_predictor *pred, const double *px)
+{
+	int nr_class = pred->nr_class;
+	int *vote = pred->vote;
+	int *pending = pred->pending;
+	int *ready = pred->ready;
+	int *done = pred->done;
+	for(int i=0;i<nr_class;i++)
+	{
+		vote[i] = 0;
+		pending[i] = nr_class-1;
+		ready[i] = 0;
+	}
+	for(int p=0;p<pred->nr_dec;p++)
+		done[p] = 0;
+
+	// whether class a can end up ahead of class b
+	auto can_beat = [&](int a, int b)
+	{
+		return vote[a]+pending[a] > vote[b] || (vote[a]+pending[a] == vote[b] && a < b);
+	};
+
+	while(true)
+	{
+		int best = 0;
+		for(int i=1;i<nr_class;i++)
+			if(vote[i] > vote[best])
+				best = i;
+		bool decided = true;
+		for(int i=0;i<nr_class && decided;i++)
+			if(i != best && can_beat(i,best))
+				decided = false;
+		if(decided)
+			return pred->label[best];
+
+		// the class with the most possible votes against its strongest
+		// remaining opponent
+		int a = -1;
+		for(int i=0;i<nr_class;i++)
+			if(pending[i] > 0 && (a < 0 || vote[i]+pending[i] > vote[a]+pending[a]))
+				a = i;
+		int b = -1, pb = 0;
+		for(int j=0;j<nr_class;j++)
+		{
+			if(j == a)
+				continue;
+			int i0 = min(a,j), j0 = max(a,j);
+			int p = i0*(2*nr_class-i0-1)/2 + j0-i0-1;
+			if(!done[p] && (b < 0 || vote[j]+pending[j] > vote[b]+pending[b]))
+			{
+				b = j;
+				pb = p;
+			}
+		}
+
+		int i = min(a,b), j = max(a,b);
+		for(int c : {i,j})
+			if(!ready[c])
+			{
+				for(int k=pred->start[c];k<pred->start[c]+pred->nSV[c];k++)
+					pred->kvalue[k] = predictor_kernel(pred,px,k);
+				ready[c] = 1;
+			}
+
+		double dec_value = predictor_decision(pred,pb,i,j);
+		pred->dec_values[pb] = dec_value;
+		done[pb] = 1;
+		--pending[i];
+		--pending[j];
+		++vote[dec_value > 0 ? i : j];
+	}
+}
+
+double svm_predictor_predict(svm_predictor *pred, const svm_node *x, double *dec_values)
+{
+	int i,k;
+	int dim = pred->dim;
+	int l = pred->l;
+	const svm_parameter& param = pred->param;
+
+	// standardized input, padded with zeros
+	double *px = pred->x;
+	for(k=0;k<dim;k++)
+	{
+#ifdef _DENSE_REP
+		px[k] = k < x->dim ? x->values[k] : 0;
+#else
+		px[k] = 0;
+#endif
+	}
+#ifndef _DENSE_REP
+	for(const svm_node *p = x; p->index != -1; p++)
+		if(p->index <= dim)
+			px[p->index-1] = p->value;
+#endif
+	if(pred->x_shift)
+		for(k=0;k<dim;k++)
+			px[k] = (px[k] - pred->x_shift[k]) * pred->x_scale[k];
+
+	if(dec_values == NULL)
+		dec_values = pred->dec_values;
+
+	if(pred->nr_monomial > 0)
+	{
+		// primal form: monomials of the input, then their weighted sums
+		int M = pred->nr_monomial;
+		double *monomial = pred->monomial;
+		monomial[0] = 1;
+		for(int t=1;t<M;t++)
+			monomial[t] = monomial[pred->mono_parent[t]]*px[pred->mono_var[t]];
+		for(int p=0;p<pred->nr_dec;p++)
+		{
+			const double *w = pred->w + (size_t)p*M;
+			double sum = 0;
+			for(int t=0;t<M;t++)
+				sum += w[t]*monomial[t];
+			dec_values[p] = sum - pred->rho[p];
+		}
+	}
+	else
+	{
+		if(pred->fast && dec_values == pred->dec_values && pred->label)
+		{
+			if(pred->order && pred->bound_pause > 0)
+				pred->bound_pause--;
+			else if(pred->order)
+			{
+				int label;
+				bool decided = predict_binary_bounded(pred,px,&label);
+				// pauses the bounded sums while they skip few terms
+				if(++pred->bound_calls == BOUND_TRIAL)
+				{
+					if(pred->bound_terms > 0.75*BOUND_TRIAL*l)
+						pred->bound_pause = BOUND_PAUSE;
+					pred->bound_calls = 0;
+					pred->bound_terms = 0;
+				}
+				if(decided)
+					return label;
+			}
+			else
+				return predict_vote_early(pred,px);
+		}
+
+		double *kvalue = pred->kvalue;
+		for(i=0;i<l;i++)
+			kvalue[i] = predictor_kernel(pred,px,i);
+
+		int p=0;
+		for(i=0;i<pred->nr_class;i++)
+			for(int j=i+1;j<pred->nr_class;j++)
+			{
+				dec_values[p] = predictor_decision(pred,p,i,j);
+				if(++p == pred->nr_dec)
+					break;
+			}
+	}
+
+	if(param.svm_type == ONE_CLASS)
+		return (dec_values[0]>0)?1:-1;
+	else if(param.svm_type == EPSILON_SVR ||
+		param.svm_type == NU_SVR)
+		return dec_values[0];
+
+	int nr_class = pred->nr_class;
+	int *vote = pred->vote;
+	for(i=0;i<nr_class;i++)
+		vote[i] = 0;
+
+	int p=0;
+	for(i=0;i<nr_class;i++)
+		for(int j=i+1;j<nr_class;j++)
+		{
+			if(dec_values[p] > 0)
+				++vote[i];
+			else
+				++vote[j];
+			p++;
+		}
+
+	int vote_max_idx = 0;
+	for(i=1;i<nr_class;i++)
+		if(vote[i] > vote[vote_max_idx])
+			vote_max_idx = i;
+
+	return pred->label[vote_max_idx];
+}
+
+void svm_predictor_free(svm_predictor *pred)
+{
+	if(pred == NULL)
+		return;
+	if(!pred->shared)
+	{
+		free(pred->SV);
+		free(pred->start);
+		free(pred->nSV);
+		free(pred->coef);
+		free(pred->coef_start);
+		free(pred->rho);
+		free(pred->label);
+		free(pred->x_shift);
+		free(pred->x_scale);
+		free(pred->mono_parent);
+		free(pred->mono_var);
+		free(pred->w);
+		free(pred->order);
+		free(pred->coef_bound);
+		free(pred->norm_min);
+		free(pred->norm_max);
+	}
+	free(pred->x);
+	free(pred->kvalue);
+	free(pred->dec_values);
+	free(pred->vote);
+	free(pred->monomial);
+	free(pred->pending);
+	free(pred->ready);
+	free(pred->done);
+	free(pred);
+}
+
+// Switches the calling thread to the C locale while in scope, leaving the
+// locale of the process and of the other threads unchanged
+class Scoped_C_Locale
+{
+public:
+	Scoped_C_Locale()
+	: c_locale(newlocale(LC_ALL_MASK, "C", (locale_t)0)),
+	  old_locale(c_locale ? uselocale(c_locale) : (locale_t)0)
+	{
+	}
+	~Scoped_C_Locale()
+	{
+		if(c_locale)
+		{
+			uselocale(old_locale);
+			freelocale(c_locale);
+		}
+	}
+private:
+	Scoped_C_Locale(const Scoped_C_Locale&);
+	Scoped_C_Locale& operator=(const Scoped_C_Locale&);
+
+	locale_t c_locale;
+	locale_t old_locale;
+};
+
 static const char *svm_type_table[] =
 {
 	"c_svc","nu_svc","one_class","epsilon_svr","nu_svr",NULL
@@ -2786,11 +3944,7 @@ int svm_save_model(const char *model_file_name, const svm_model *model)
 	FILE *fp = fopen(model_file_name,"w");
 	if(fp==NULL) return -1;
 
-	char *old_locale = setlocale(LC_ALL, NULL);
-	if (old_locale) {
-		old_locale = strdup(old_locale);
-	}
-	setlocale(LC_ALL, "C");
+	Scoped_C_Locale c_locale;
 
 	const svm_parameter& param = model->param;
 
@@ -2849,6 +4003,18 @@ int svm_save_model(const char *model_file_name, const svm_model *model)
 		fprintf(fp, "\n");
 	}
 
+	if(model->nr_scale)
+	{
+		fprintf(fp, "x_shift %d", model->nr_scale);
+		for(int i=0;i<model->nr_scale;i++)
+			fprintf(fp," %.17g",model->x_shift[i]);
+		fprintf(fp, "\n");
+		fprintf(fp, "x_scale %d", model->nr_scale);
+		for(int i=0;i<model->nr_scale;i++)
+			fprintf(fp," %.17g",model->x_scale[i]);
+		fprintf(fp, "\n");
+	}
+
 	fprintf(fp, "SV\n");
 	const double * const *sv_coef = model->sv_coef;
 #ifdef _DENSE_REP
@@ -2886,32 +4052,29 @@ int svm_save_model(const char *model_file_name, const svm_model *model)
 		fprintf(fp, "\n");
 	}
 
-	setlocale(LC_ALL, old_locale);
-	free(old_locale);
-
 	if (ferror(fp) != 0 || fclose(fp) != 0) return -1;
 	else return 0;
 }
 
-static char *line = NULL;
-static int max_line_len;
-
-static char* readline(FILE *input)
+// Reads a line into the buffer *line of *max_line_len bytes, growing it
+// as needed; the buffer belongs to the caller so that models can be read
+// concurrently
+static char* readline(FILE *input, char **line, int *max_line_len)
 {
 	int len;
 
-	if(fgets(line,max_line_len,input) == NULL)
+	if(fgets(*line,*max_line_len,input) == NULL)
 		return NULL;
 
-	while(strrchr(line,'\n') == NULL)
+	while(strrchr(*line,'\n') == NULL)
 	{
-		max_line_len *= 2;
-		line = (char *) realloc(line,max_line_len);
-		len = (int) strlen(line);
-		if(fgets(line+len,max_line_len-len,input) == NULL)
+		*max_line_len *= 2;
+		*line = (char *) realloc(*line,*max_line_len);
+		len = (int) strlen(*line);
+		if(fgets(*line+len,*max_line_len-len,input) == NULL)
 			break;
 	}
-	return line;
+	return *line;
 }
 
 //
@@ -3016,6 +4179,20 @@ bool read_model_header(FILE *fp, svm_model* model)
 			for(int i=0;i<n;i++)
 				FSCANF(fp,"%d",&model->nSV[i]);
 		}
+		else if(strcmp(cmd,"x_shift")==0)
+		{
+			FSCANF(fp,"%d",&model->nr_scale);
+			model->x_shift = Malloc(double,model->nr_scale);
+			for(int i=0;i<model->nr_scale;i++)
+				FSCANF(fp,"%lf",&model->x_shift[i]);
+		}
+		else if(strcmp(cmd,"x_scale")==0)
+		{
+			FSCANF(fp,"%d",&model->nr_scale);
+			model->x_scale = Malloc(double,model->nr_scale);
+			for(int i=0;i<model->nr_scale;i++)
+				FSCANF(fp,"%lf",&model->x_scale[i]);
+		}
 		else if(strcmp(cmd,"SV")==0)
 		{
 			while(1)
@@ -3041,11 +4218,7 @@ svm_model *svm_load_model(const char *model_file_name)
 	FILE *fp = fopen(model_file_name,"rb");
 	if(fp==NULL) return NULL;
 
-	char *old_locale = setlocale(LC_ALL, NULL);
-	if (old_locale) {
-		old_locale = strdup(old_locale);
-	}
-	setlocale(LC_ALL, "C");
+	Scoped_C_Locale c_locale;
 
 	// read parameters
 
@@ -3056,16 +4229,21 @@ svm_model *svm_load_model(const char *model_file_name)
 	model->sv_indices = NULL;
 	model->label = NULL;
 	model->nSV = NULL;
+	model->nr_scale = 0;
+	model->x_shift = NULL;
+	model->x_scale = NULL;
+	clear_stats(&model->stats);
+	memset(&model->reduction,0,sizeof(model->reduction));
 
 	// read header
 	if (!read_model_header(fp, model))
 	{
 		fprintf(stderr, "ERROR: fscanf failed to read model\n");
-		setlocale(LC_ALL, old_locale);
-		free(old_locale);
 		free(model->rho);
 		free(model->label);
 		free(model->nSV);
+		free(model->x_shift);
+		free(model->x_scale);
 		free(model);
 		return NULL;
 	}
@@ -3075,14 +4253,14 @@ svm_model *svm_load_model(const char *model_file_name)
 	int elements = 0;
 	long pos = ftell(fp);
 
-	max_line_len = 1024;
-	line = Malloc(char,max_line_len);
-	char *p,*endptr,*idx,*val;
+	int max_line_len = 1024;
+	char *line = Malloc(char,max_line_len);
+	char *p,*endptr,*idx,*val,*saveptr;
 
 #ifdef _DENSE_REP
 	int max_index = 1;
 	// read the max dimension of all vectors
-	while(readline(fp) != NULL)
+	while(readline(fp,&line,&max_line_len) != NULL)
 	{
 		char *p;
 		p = strrchr(line, ':');
@@ -3097,12 +4275,12 @@ svm_model *svm_load_model(const char *model_file_name)
 			elements = max_index;
 	}
 #else
-	while(readline(fp)!=NULL)
+	while(readline(fp,&line,&max_line_len)!=NULL)
 	{
-		p = strtok(line,":");
+		p = strtok_r(line,":",&saveptr);
 		while(1)
 		{
-			p = strtok(NULL,":");
+			p = strtok_r(NULL,":",&saveptr);
 			if(p == NULL)
 				break;
 			++elements;
@@ -3126,24 +4304,24 @@ svm_model *svm_load_model(const char *model_file_name)
 
 	for(i=0;i<l;i++)
 	{
-		readline(fp);
+		readline(fp,&line,&max_line_len);
 
 		model->SV[i].values = Malloc(double, elements);
 		model->SV[i].dim = 0;
 
-		p = strtok(line, " \t");
+		p = strtok_r(line, " \t", &saveptr);
 		model->sv_coef[0][i] = strtod(p,&endptr);
 		for(int k=1;k<m;k++)
 		{
-			p = strtok(NULL, " \t");
+			p = strtok_r(NULL, " \t", &saveptr);
 			model->sv_coef[k][i] = strtod(p,&endptr);
 		}
 
 		int *d = &(model->SV[i].dim);
 		while(1)
 		{
-			idx = strtok(NULL, ":");
-			val = strtok(NULL, " \t");
+			idx = strtok_r(NULL, ":", &saveptr);
+			val = strtok_r(NULL, " \t", &saveptr);
 
 			if(val == NULL)
 				break;
@@ -3160,21 +4338,21 @@ svm_model *svm_load_model(const char *model_file_name)
 	int j=0;
 	for(i=0;i<l;i++)
 	{
-		readline(fp);
+		readline(fp,&line,&max_line_len);
 		model->SV[i] = &x_space[j];
 
-		p = strtok(line, " \t");
+		p = strtok_r(line, " \t", &saveptr);
 		model->sv_coef[0][i] = strtod(p,&endptr);
 		for(int k=1;k<m;k++)
 		{
-			p = strtok(NULL, " \t");
+			p = strtok_r(NULL, " \t", &saveptr);
 			model->sv_coef[k][i] = strtod(p,&endptr);
 		}
 
 		while(1)
 		{
-			idx = strtok(NULL, ":");
-			val = strtok(NULL, " \t");
+			idx = strtok_r(NULL, ":", &saveptr);
+			val = strtok_r(NULL, " \t", &saveptr);
 
 			if(val == NULL)
 				break;
@@ -3188,9 +4366,6 @@ svm_model *svm_load_model(const char *model_file_name)
 #endif
 	free(line);
 
-	setlocale(LC_ALL, old_locale);
-	free(old_locale);
-
 	if (ferror(fp) != 0 || fclose(fp) != 0)
 		return NULL;
 
@@ -3236,6 +4411,13 @@ void svm_free_model_content(svm_model* model_ptr)
 
 	free(model_ptr->nSV);
 	model_ptr->nSV = NULL;
+
+	free(model_ptr->x_shift);
+	model_ptr->x_shift = NULL;
+
+	free(model_ptr->x_scale);
+	model_ptr->x_scale = NULL;
+	model_ptr->nr_scale = 0;
 }
 
 void svm_free_and_destroy_model(svm_model** model_ptr_ptr)
@@ -3389,7 +4571,7 @@ int svm_check_probability_model(const svm_model *model)
 void svm_set_print_string_function(void (*print_func)(const char *))
 {
 	if(print_func == NULL)
-		svm_print_string = &print_string_stdout;
+		svm_print_string.store(&print_string_stdout);
 	else
-		svm_print_string = print_func;
+		svm_print_string.store(print_func);
 }
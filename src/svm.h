@@ -74,6 +74,7 @@ struct svm_problem
 
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
+enum { STANDARDIZE_NONE, STANDARDIZE_BOUNDS, STANDARDIZE_SAMPLES }; /* standardize */
 
 struct svm_parameter
 {
@@ -99,6 +100,33 @@ struct svm_parameter
 	double coef_max; /* regenerate model if any coefficients exceed this */
 	int max_retries; /* retry the above at most this many times */
 	int min_SVs; /* the starting number of SVs to attempt training the model with */
+	double linear_tol; /* use a linear split if its training error rate is at most this (0: only if it separates the training set), < 0 to disable */
+	int standardize; /* per-dimension scaling of the training points */
+	int max_iter; /* solver iterations per decision function, 0 for the default */
+	double max_time; /* wall time of a whole training in seconds, 0 for no limit */
+	double eps_coarse; /* solve to this tolerance first, then ten times finer down to eps, */
+			   /* stopping once the training predictions do not change; 0 to disable */
+	double reduce_tol; /* approximate each model with fewer SVs, changing the predictions */
+			   /* of at most this fraction of its training set; 0 to disable */
+};
+
+enum { SOLVER_CONVERGED, SOLVER_STABLE, SOLVER_MAX_ITER, SOLVER_MAX_TIME }; /* status */
+
+/* solver statistics of a training, over all its decision functions */
+struct svm_solver_stats
+{
+	int iter;	/* total solver iterations */
+	double time;	/* wall time in seconds */
+	double eps;	/* largest tolerance the solver stopped at */
+	int status;	/* worst reason the solver stopped for */
+};
+
+/* result of approximating a model with fewer SVs */
+struct svm_reduction_stats
+{
+	int l;			/* number of SVs of the original model, 0 if not reduced */
+	double agreement;	/* fraction of the training set predicted the same */
+	double speedup;		/* prediction time of the original over the reduced model */
 };
 
 //
@@ -128,9 +156,79 @@ struct svm_model
 	/* XXX */
 	int free_sv;		/* 1 if svm_model is created by svm_load_model*/
 				/* 0 if svm_model is created by svm_train */
+
+	/* input standardization, applied before evaluating the kernel */
+	int nr_scale;		/* number of scaled dimensions, 0 if none */
+	double *x_shift;	/* x'[i] = (x[i] - x_shift[i]) * x_scale[i] */
+	double *x_scale;
+
+	struct svm_solver_stats stats;	/* zero for loaded models */
+	struct svm_reduction_stats reduction;	/* zero unless reduced */
+};
+
+//
+// svm_predictor: a model compiled for repeated prediction
+//
+struct svm_predictor
+{
+	struct svm_parameter param;	/* kernel parameters */
+	int nr_class;		/* number of classes, = 2 in regression/one class svm */
+	int l;			/* total #SV */
+	int dim;		/* dimension of the SVs */
+	double *SV;		/* SVs, row by row (SV[l*dim]) */
+	int *start;		/* first SV of each class (start[k]) */
+	int *nSV;		/* number of SVs of each class (nSV[k]) */
+	double *coef;		/* coefficients of decision function p: those of the SVs of */
+				/* its first class, then of its second, from coef_start[p] */
+	int *coef_start;	/* (coef_start[k*(k-1)/2]) */
+	double *rho;		/* constants in decision functions (rho[k*(k-1)/2]) */
+	int *label;		/* label of each class (label[k]) */
+	double *x_shift;	/* input standardization, NULL if none (x_shift[dim]) */
+	double *x_scale;
+	int nr_dec;		/* number of decision values */
+	int nr_coef;		/* size of coef */
+
+	/* primal form of POLY and LINEAR models, used when it is cheaper */
+	int nr_monomial;	/* number of monomials up to the degree, 0 if unused */
+	int *mono_parent;	/* monomial t > 0 is monomial mono_parent[t] times */
+	int *mono_var;		/* x[mono_var[t]]; monomial 0 is 1 */
+	double *w;		/* weights of the monomials in decision function p, */
+				/* from w[p*nr_monomial] */
+
+	/* workspace, so that predictions do not allocate */
+	double *x;		/* standardized input (x[dim]) */
+	double *kvalue;		/* kernel values (kvalue[l]) */
+	double *dec_values;	/* decision values (dec_values[k*(k-1)/2]) */
+	int *vote;		/* votes of each class (vote[k]) */
+	double *monomial;	/* monomial values (monomial[nr_monomial]) */
+
+	/* exact fast prediction, used when fast is nonzero and dec_values is NULL */
+	int fast;
+	int *order;		/* two classes: SVs by decreasing bound of their term */
+				/* (order[l]) */
+	double *coef_bound;	/* sum of |coef| of SVs order[k..l) (coef_bound[l+1]) */
+	double *norm_min;	/* smallest norm of SVs order[k..l) (norm_min[l+1]) */
+	double *norm_max;	/* largest norm of SVs order[k..l) (norm_max[l+1]) */
+	int *pending;		/* decision functions left for each class (pending[k]) */
+	int *ready;		/* whether the kernel values of class k are computed */
+	int *done;		/* whether decision function p is computed (done[k*(k-1)/2]) */
+	int bound_calls;	/* bounded sums since the last check of their benefit */
+	int bound_terms;	/* number of terms they computed */
+	int bound_pause;	/* predictions left before trying bounded sums again */
+
+	int shared;		/* the arrays other than the workspace are not owned, */
+				/* see svm_predictor_share */
 };
 
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
+/*
+ * Retrains a model after points were added to its training set. init_index[i]
+ * is the index of point i in the training set of init, or -1 for new points.
+ * Decision functions between classes without new points are copied from init,
+ * the others start from the solution in init.
+ */
+struct svm_model *svm_train_warm(const struct svm_problem *prob, const struct svm_parameter *param,
+				 const struct svm_model *init, const int *init_index);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
 
 int svm_save_model(const char *model_file_name, const struct svm_model *model);
@@ -146,6 +244,37 @@ double svm_get_svr_probability(const struct svm_model *model);
 double svm_predict_values(const struct svm_model *model, const struct svm_node *x, double* dec_values);
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
+/* kernel value between two points, e.g. to fill a PRECOMPUTED kernel matrix */
+double svm_kernel(const struct svm_node *x, const struct svm_node *y, const struct svm_parameter *param);
+
+/*
+ * Compiles a model for prediction, returning NULL if out of memory or for
+ * PRECOMPUTED kernels. The predictor does not refer to the model. Predicting
+ * uses its workspace, so each thread needs its own predictor.
+ *
+ * POLY and LINEAR decision functions are expanded into weights of the
+ * monomials of the input when there are fewer monomials than SV terms; the
+ * cost of predicting then does not depend on the number of SVs.
+ */
+struct svm_predictor *svm_predictor_create(const struct svm_model *model);
+struct svm_predictor *svm_predictor_copy(const struct svm_predictor *predictor);
+/*
+ * Returns a predictor using the SVs, coefficients and other constant arrays
+ * of predictor without copying them, with a workspace of its own; NULL if out
+ * of memory. The arrays, which may e.g. be in a mapped file, must outlive the
+ * result and are not freed with it.
+ */
+struct svm_predictor *svm_predictor_share(const struct svm_predictor *predictor);
+/*
+ * same as svm_predict_values; dec_values may be NULL. If it is NULL and
+ * predictor->fast is set, classification stops as soon as the result is
+ * known: decision functions are evaluated until no other class can win the
+ * vote, kernel values only for the classes involved, and the sum of a
+ * two-class model until the remaining terms cannot change its sign. The
+ * result is the same.
+ */
+double svm_predictor_predict(struct svm_predictor *predictor, const struct svm_node *x, double *dec_values);
+void svm_predictor_free(struct svm_predictor *predictor);
 
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "debug.h"
+#include "buildpart_common.h"
+#include "parallel.h"
+#include "tune_svm.h"
+
+// maximum number of points the cross validation is run on, as the kernel
+// matrix holds the square of this many values
+static const size_t TUNE_MAX_POINTS = 3000;
+
+/**
+ * Takes evenly spaced points of every region, so that the sample keeps the
+ * proportions of the regions and has about `TUNE_MAX_POINTS` points at most.
+ */
+static inline
+void sample_problem(PSP_Result const& regions,
+                    std::vector<svm_node>& x,
+                    std::vector<double>& y,
+                    std::vector<double>& values)
+{
+    size_t dim = nDim(regions);
+
+    size_t num_points = 0;
+    for (auto const& points : regions.xs) {
+        num_points += points.size();
+    }
+
+    std::vector<size_t> selected;
+    for (size_t j = 0; j < regions.patterns.size(); j++) {
+        size_t count = regions.xs[j].size();
+        size_t take = num_points > TUNE_MAX_POINTS
+                    ? (count * TUNE_MAX_POINTS + num_points - 1) / num_points
+                    : count;
+
+        for (size_t k = 0; k < take; k++) {
+            selected.push_back(j);
+            values.resize(values.size() + dim);
+            Eigen::Map<Point>(values.data() + values.size() - dim, dim) =
+                regions.xs[j][k * count / take];
+        }
+    }
+
+    for (size_t i = 0; i < selected.size(); i++) {
+        x.push_back(svm_node{ (int)dim, values.data() + i * dim });
+        y.push_back(regions.patterns[selected[i]]);
+    }
+}
+
+/**
+ * Assigns the points of every class to the folds in turn, after shuffling
+ * them, so that each fold has about the same share of every class.
+ */
+static inline
+std::vector<int> stratified_folds(std::vector<double> const& y,
+                                  int nfold)
+{
+    std::vector<int> folds(y.size());
+    std::default_random_engine generator(0);
+
+    int next = 0;
+    for (size_t begin = 0, end; begin < y.size(); begin = end) {
+        for (end = begin; end < y.size() && y[end] == y[begin]; end++) {
+        }
+
+        std::vector<size_t> order(end - begin);
+        std::iota(order.begin(), order.end(), begin);
+        std::shuffle(order.begin(), order.end(), generator);
+        for (size_t i : order) {
+            folds[i] = next;
+            next = (next + 1) % nfold;
+        }
+    }
+
+    return folds;
+}
+
+/**
+ * Lists the parameter sets of the grid, grouped by kernel: the penalty (`C` or
+ * `nu` depending on the SVM type) varies fastest. Axes which the kernel or the
+ * SVM type ignore are not expanded.
+ */
+static inline
+std::vector<svm_parameter> grid_parameters(svm_parameter const& base,
+                                           PSP_SVM_GridRec const& grid,
+                                           size_t* num_penalties)
+{
+    int kernel = base.kernel_type;
+    bool use_gamma = kernel == POLY || kernel == RBF || kernel == SIGMOID;
+    bool use_degree = kernel == POLY;
+    bool use_coef0 = kernel == POLY || kernel == SIGMOID;
+    bool use_C = base.svm_type == C_SVC;
+    bool use_nu = base.svm_type == NU_SVC;
+
+    int num_gamma = use_gamma && grid.num_gamma > 0 ? grid.num_gamma : 1;
+    int num_degree = use_degree && grid.num_degree > 0 ? grid.num_degree : 1;
+    int num_coef0 = use_coef0 && grid.num_coef0 > 0 ? grid.num_coef0 : 1;
+    int num_C = use_C && grid.num_C > 0 ? grid.num_C : 1;
+    int num_nu = use_nu && grid.num_nu > 0 ? grid.num_nu : 1;
+
+    std::vector<svm_parameter> result;
+    for (int a = 0; a < num_gamma; a++)
+    for (int b = 0; b < num_degree; b++)
+    for (int c = 0; c < num_coef0; c++)
+    for (int d = 0; d < num_C; d++)
+    for (int e = 0; e < num_nu; e++) {
+        svm_parameter param = base;
+        if (use_gamma && grid.num_gamma > 0)
+            param.gamma = grid.gamma[a];
+        if (use_degree && grid.num_degree > 0)
+            param.degree = grid.degree[b];
+        if (use_coef0 && grid.num_coef0 > 0)
+            param.coef0 = grid.coef0[c];
+        if (use_C && grid.num_C > 0)
+            param.C = grid.C[d];
+        if (use_nu && grid.num_nu > 0)
+            param.nu = grid.nu[e];
+        result.push_back(param);
+    }
+
+    *num_penalties = num_C * num_nu;
+    return result;
+}
+
+/**
+ * Selects the parameter set of the grid with the fewest misclassified points
+ * in a stratified k-fold cross validation of the multi-class problem, on a
+ * sample of the regions. The kernel matrix of each kernel parameter set is
+ * computed once and shared by all penalties and folds, which run in parallel.
+ * A parameter set is abandoned as soon as its errors exceed those of the best
+ * complete one.
+ */
+svm_parameter tune_svm(PSP_Result const& data,
+                       svm_parameter const* parameters,
+                       PSP_SVM_GridRec const& grid,
+                       int nfold)
+{
+    svm_parameter base = svm_parameters(parameters);
+    base.probability = 0;
+
+    std::vector<svm_node> x;
+    std::vector<double> y;
+    std::vector<double> values;
+    sample_problem(data, x, y, values);
+
+    size_t l = x.size();
+    if (nfold < 2 || (size_t)nfold > l)
+        throw std::invalid_argument("number of folds out of range");
+
+    svm_problem problem = { (int)l, y.data(), x.data() };
+    standardize_problem(&problem, data, base);
+
+    std::vector<int> folds = stratified_folds(y, nfold);
+
+    size_t num_penalties;
+    std::vector<svm_parameter> params = grid_parameters(base, grid, &num_penalties);
+    size_t num_kernels = params.size() / num_penalties;
+
+    std::mutex mutex;
+    std::vector<size_t> errors(params.size(), 0);
+    std::vector<int> folds_done(params.size(), 0);
+    size_t best = 0;
+    size_t best_errors = std::numeric_limits<size_t>::max();
+
+    // row i holds its index in front of the kernel values, as svm_train
+    // expects for PRECOMPUTED kernels
+    std::vector<double> gram(l * (l + 1));
+    std::vector<svm_node> rows(l);
+    for (size_t i = 0; i < l; i++) {
+        rows[i] = svm_node{ (int)(l + 1), gram.data() + i * (l + 1) };
+    }
+
+    for (size_t k = 0; k < num_kernels; k++) {
+        svm_parameter const& kernel = params[k * num_penalties];
+
+        parallel_for(l, [&](size_t i) {
+            rows[i].values[0] = i + 1;
+            for (size_t j = 0; j <= i; j++) {
+                double value = svm_kernel(&x[i], &x[j], &kernel);
+                rows[i].values[j + 1] = value;
+                rows[j].values[i + 1] = value;
+            }
+        });
+
+        parallel_for(num_penalties * nfold, [&](size_t t) {
+            size_t g = k * num_penalties + t / nfold;
+            int fold = t % nfold;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (errors[g] > best_errors) {
+                    return;
+                }
+            }
+
+            svm_parameter param = params[g];
+            param.kernel_type = PRECOMPUTED;
+
+            std::vector<svm_node> sub_x;
+            std::vector<double> sub_y;
+            for (size_t i = 0; i < l; i++) {
+                if (folds[i] != fold) {
+                    sub_x.push_back(rows[i]);
+                    sub_y.push_back(y[i]);
+                }
+            }
+            svm_problem sub = { (int)sub_x.size(), sub_y.data(), sub_x.data() };
+
+            // infeasible parameters count as more errors than there are points
+            size_t fold_errors = l + 1;
+            if (!svm_check_parameter(&sub, &param)) {
+                svm_model* model = svm_train(&sub, &param);
+                fold_errors = 0;
+                for (size_t i = 0; i < l; i++) {
+                    if (folds[i] == fold && svm_predict(model, &rows[i]) != y[i]) {
+                        fold_errors++;
+                    }
+                }
+                svm_free_and_destroy_model(&model);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            errors[g] += fold_errors;
+            if (++folds_done[g] == nfold) {
+                DEBUG_LOG("tune_svm: gamma " << params[g].gamma << " degree " << params[g].degree
+                          << " coef0 " << params[g].coef0 << " C " << params[g].C
+                          << " nu " << params[g].nu << ": " << errors[g] << " errors\n");
+                if (errors[g] < best_errors || (errors[g] == best_errors && g < best)) {
+                    best = g;
+                    best_errors = errors[g];
+                }
+            }
+        });
+    }
+
+    DEBUG_LOG("tune_svm: best " << best_errors << " errors in " << l << " points\n");
+
+    return params[best];
+}
+
+/* EOF */
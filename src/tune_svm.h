@@ -0,0 +1,43 @@
+#ifndef TUNE_SVM_H
+#define TUNE_SVM_H
+
+#include "svm.h"
+
+#ifdef __cplusplus
+#include "psp_mcmc.h"
+
+
+extern "C"
+{
+#endif
+
+/**
+ * Values tried for each SVM parameter. An empty list keeps the configured
+ * value of the parameter.
+ */
+typedef struct PSP_SVM_GridRec_ {
+    int num_gamma;
+    const double* gamma;
+    int num_degree;
+    const int* degree;
+    int num_coef0;
+    const double* coef0;
+    int num_C;
+    const double* C;
+    int num_nu;
+    const double* nu;
+} PSP_SVM_GridRec, *PSP_SVM_Grid;
+
+#ifdef __cplusplus
+}
+
+
+svm_parameter tune_svm(PSP_Result const& data,
+                       svm_parameter const* param,
+                       PSP_SVM_GridRec const& grid,
+                       int nfold);
+#endif
+
+#endif
+
+/* EOF */